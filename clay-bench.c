@@ -0,0 +1,213 @@
+/* clay-bench.c
+ * Multi-stripe encode throughput of the (14, 10) Clay code, with the
+ * coupled sub-chunks written through the cache or with non-temporal
+ * stores.
+ *
+ * usage: clay-bench blocksize stripes [passes [packetsize]]
+ *
+ * A stripe is the 128 layers of the (14, 10, 11) code's 14 sub-chunks of blocksize bytes, laid out
+ * like encoder.c's fdata/fcoding: node n of layer z at (z*14 + n) *
+ * blocksize.  Each stripe is encoded the way encoder.c does it: the data
+ * is copied in from its own input buffer, the base code makes the 4
+ * parity sub-chunks of every layer, then the coupled pairs are rewritten
+ * in place.  The output is not read again before the
+ * next pass, so how much of the next stripe's input is still cached
+ * depends on how much the previous stripe's output pushed out.
+ *
+ * Streaming stores apply to pairs whose sub-chunks sit at the same offset
+ * from a 64-byte boundary, so blocksize should be a multiple of 64.
+ * Throughput is data bytes encoded per second.  The cached and streaming
+ * outputs of one stripe are compared first.
+ *
+ * The coupling alone is then timed with the GF(2^8) table
+ * kernels and with the XOR-schedule coupler that the cauchy codes use
+ * (w = 8, packetsize 64 by default), which is the comparison that
+ * matters on CPUs without a fast byte shuffle.  That needs blocksize to
+ * be a multiple of 8 * packetsize.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jerasure.h"
+#include "reed_sol.h"
+#include "galois.h"
+#include "galois_ext.h"
+#include "clay.h"
+
+#define K      10
+#define M      4
+#define N      (K + M)
+#define GAMMA  2
+
+static clay_code *code;
+
+static char *node(char *stripe, int z, int n, int blocksize)
+{
+  return stripe + ((long) z * N + n) * blocksize;
+}
+
+static void couple_stripe(char *stripe, clay_coupler *coupler, int blocksize)
+{
+  const clay_pair *pr;
+  int i;
+
+  for (i = 0; i < code->plan->npairs; i++) {
+    pr = code->plan->pairs + i;
+    clay_coupler_couple(coupler, node(stripe, pr->za, pr->a, blocksize),
+                        node(stripe, pr->zb, pr->b, blocksize), blocksize);
+  }
+}
+
+static void encode_stripe(char *in, char *stripe, galois_w08_tables *tables,
+                          clay_coupler *coupler, int blocksize)
+{
+  char *data[K];
+  char *coding[M];
+  int z, i;
+
+  for (z = 0; z < code->alpha; z++) {
+    for (i = 0; i < K; i++) {
+      data[i] = node(stripe, z, i, blocksize);
+      memcpy(data[i], in + ((long) z * K + i) * blocksize, blocksize);
+    }
+    for (i = 0; i < M; i++) coding[i] = node(stripe, z, K + i, blocksize);
+    galois_w08_region_dot_prod(K, M, tables, data, coding, blocksize);
+  }
+  couple_stripe(stripe, coupler, blocksize);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* With tables NULL only the coupling runs. */
+
+static double run(char **in, char **stripes, int nstripes, int passes,
+                  galois_w08_tables *tables, clay_coupler *coupler, int blocksize)
+{
+  double start, elapsed;
+  int p, i;
+
+  start = 0;
+  for (p = -1; p < passes; p++) {
+    if (p == 0) start = now();
+    for (i = 0; i < nstripes; i++) {
+      if (tables != NULL) {
+        encode_stripe(in[i], stripes[i], tables, coupler, blocksize);
+      } else {
+        couple_stripe(stripes[i], coupler, blocksize);
+      }
+    }
+  }
+  elapsed = now() - start;
+  return (double) passes * nstripes * code->alpha * K * blocksize / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+  galois_w08_tables *tables;
+  clay_coupler *coupler, *xor_coupler;
+  char **in, **stripes;
+  char *check[2];
+  long stripe_bytes;
+  int blocksize, nstripes, passes, packetsize;
+  int *matrix;
+  int i, j;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: clay-bench blocksize stripes [passes [packetsize]]\n");
+    exit(1);
+  }
+  blocksize = atoi(argv[1]);
+  nstripes = atoi(argv[2]);
+  passes = (argc > 3) ? atoi(argv[3]) : 3;
+  packetsize = (argc > 4) ? atoi(argv[4]) : 64;
+  if (blocksize <= 0 || nstripes <= 0 || passes <= 0 || packetsize <= 0) {
+    fprintf(stderr, "clay-bench: blocksize, stripes, passes and packetsize must be positive\n");
+    exit(1);
+  }
+  code = clay_code_new(N, K, K + 1);
+  if (code == NULL) {
+    fprintf(stderr, "clay-bench: out of memory\n");
+    exit(1);
+  }
+  stripe_bytes = (long) code->alpha * N * blocksize;
+
+  matrix = reed_sol_vandermonde_coding_matrix(K, M, 8);
+  tables = galois_w08_dot_prod_init(K, M, matrix);
+  coupler = clay_coupler_new(GAMMA, 8, 0);
+  in = (char **) malloc(sizeof(char *) * nstripes);
+  stripes = (char **) malloc(sizeof(char *) * nstripes);
+  if (matrix == NULL || tables == NULL || coupler == NULL || in == NULL || stripes == NULL) {
+    fprintf(stderr, "clay-bench: out of memory\n");
+    exit(1);
+  }
+  srand(1);
+  for (i = 0; i < nstripes; i++) {
+    if (posix_memalign((void **) &in[i], 64, stripe_bytes) != 0 ||
+        posix_memalign((void **) &stripes[i], 64, stripe_bytes) != 0) {
+      fprintf(stderr, "clay-bench: out of memory\n");
+      exit(1);
+    }
+    for (j = 0; j < stripe_bytes; j++) in[i][j] = rand();
+  }
+
+  for (i = 0; i < 2; i++) {
+    if (posix_memalign((void **) &check[i], 64, stripe_bytes) != 0) {
+      fprintf(stderr, "clay-bench: out of memory\n");
+      exit(1);
+    }
+    coupler->nt = i;
+    encode_stripe(in[0], check[i], tables, coupler, blocksize);
+  }
+  if (memcmp(check[0], check[1], stripe_bytes) != 0) {
+    fprintf(stderr, "clay-bench: streaming and cached encodes differ\n");
+    exit(1);
+  }
+
+  printf("blocksize %d, %d stripes of %.1f MB, %d passes\n",
+         blocksize, nstripes, stripe_bytes / 1e6, passes);
+  coupler->nt = 0;
+  printf("encode, cached stores:    %8.1f MB/s\n",
+         run(in, stripes, nstripes, passes, tables, coupler, blocksize));
+  coupler->nt = 1;
+  printf("encode, streaming stores: %8.1f MB/s\n",
+         run(in, stripes, nstripes, passes, tables, coupler, blocksize));
+
+  coupler->nt = 0;
+  printf("coupling, table kernels:  %8.1f MB/s\n",
+         run(in, stripes, nstripes, passes, NULL, coupler, blocksize));
+  if (blocksize % (8 * packetsize) != 0) {
+    printf("coupling, XOR schedule:   skipped, blocksize is not a multiple of 8*%d\n", packetsize);
+  } else {
+    xor_coupler = clay_coupler_new(GAMMA, 8, packetsize);
+    if (xor_coupler == NULL) {
+      fprintf(stderr, "clay-bench: out of memory\n");
+      exit(1);
+    }
+    printf("coupling, XOR schedule:   %8.1f MB/s (packetsize %d)\n",
+           run(in, stripes, nstripes, passes, NULL, xor_coupler, blocksize), packetsize);
+    clay_coupler_free(xor_coupler);
+  }
+
+  for (i = 0; i < nstripes; i++) {
+    free(in[i]);
+    free(stripes[i]);
+  }
+  free(in);
+  free(stripes);
+  free(check[0]);
+  free(check[1]);
+  free(tables);
+  free(matrix);
+  clay_coupler_free(coupler);
+  clay_code_free(code);
+  return 0;
+}
@@ -0,0 +1,1328 @@
+/* clay.c
+ * Region kernels for the Clay pairwise coupling transform.
+ *
+ * Multiplication by a constant uses the tables of galois.c's shared,
+ * read-only default context for GF(2^8) mod 0x11d, so the kernels can run
+ * on many threads at once: GF2P8AFFINEQB when the CPU has GFNI, otherwise
+ * split-nibble pshufb lookups (AVX2, then SSSE3), with the same tier
+ * galois.c selected.
+ * Coupling with gamma = 2, the value the tools use, is a shift and a
+ * conditional XOR of the reduction byte and needs no tables at all below
+ * the GFNI tier.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "jerasure.h"
+#include "galois.h"
+#include "galois_ext.h"
+#include "gf8.h"
+#include "clay.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLAY_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+/* The pair kernels apply the symmetric 2x2 matrix [[s, t], [t, s]]:
+   a <- s*a + t*b,  b <- t*a + s*b.  When s == 1 (ident) the diagonal
+   product is the input itself and is not computed.  Each kernel returns
+   the number of bytes it handled; the rest goes through the nibble
+   tables one byte at a time.  With nt set, the AVX2 and GFNI kernels
+   write with streaming stores and need pa and pb 32- or 64-byte
+   aligned. */
+
+#ifdef CLAY_X86_DISPATCH
+__attribute__((target("ssse3")))
+static int clay_pair_ssse3(uint8_t *pa, uint8_t *pb, const galois_w08_tables *s,
+                           const galois_w08_tables *t, int ident, int len)
+{
+  __m128i vslo, vshi, vtlo, vthi, mask, va, vb, la, ha, lb, hb, sa, sb, ta, tb;
+  int i;
+
+  vslo = _mm_loadu_si128((__m128i *) s->lo);
+  vshi = _mm_loadu_si128((__m128i *) s->hi);
+  vtlo = _mm_loadu_si128((__m128i *) t->lo);
+  vthi = _mm_loadu_si128((__m128i *) t->hi);
+  mask = _mm_set1_epi8(0x0f);
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    va = _mm_loadu_si128((__m128i *) (pa + i));
+    vb = _mm_loadu_si128((__m128i *) (pb + i));
+    la = _mm_and_si128(va, mask);
+    ha = _mm_and_si128(_mm_srli_epi64(va, 4), mask);
+    lb = _mm_and_si128(vb, mask);
+    hb = _mm_and_si128(_mm_srli_epi64(vb, 4), mask);
+    ta = _mm_xor_si128(_mm_shuffle_epi8(vtlo, la), _mm_shuffle_epi8(vthi, ha));
+    tb = _mm_xor_si128(_mm_shuffle_epi8(vtlo, lb), _mm_shuffle_epi8(vthi, hb));
+    if (ident) {
+      sa = va;
+      sb = vb;
+    } else {
+      sa = _mm_xor_si128(_mm_shuffle_epi8(vslo, la), _mm_shuffle_epi8(vshi, ha));
+      sb = _mm_xor_si128(_mm_shuffle_epi8(vslo, lb), _mm_shuffle_epi8(vshi, hb));
+    }
+    _mm_storeu_si128((__m128i *) (pa + i), _mm_xor_si128(sa, tb));
+    _mm_storeu_si128((__m128i *) (pb + i), _mm_xor_si128(sb, ta));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static int clay_pair_avx2(uint8_t *pa, uint8_t *pb, const galois_w08_tables *s,
+                          const galois_w08_tables *t, int ident, int len, int nt)
+{
+  __m256i vslo, vshi, vtlo, vthi, mask, va, vb, la, ha, lb, hb, sa, sb, ta, tb, ra, rb;
+  int i;
+
+  vslo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) s->lo));
+  vshi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) s->hi));
+  vtlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) t->lo));
+  vthi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) t->hi));
+  mask = _mm256_set1_epi8(0x0f);
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    va = _mm256_loadu_si256((__m256i *) (pa + i));
+    vb = _mm256_loadu_si256((__m256i *) (pb + i));
+    la = _mm256_and_si256(va, mask);
+    ha = _mm256_and_si256(_mm256_srli_epi64(va, 4), mask);
+    lb = _mm256_and_si256(vb, mask);
+    hb = _mm256_and_si256(_mm256_srli_epi64(vb, 4), mask);
+    ta = _mm256_xor_si256(_mm256_shuffle_epi8(vtlo, la), _mm256_shuffle_epi8(vthi, ha));
+    tb = _mm256_xor_si256(_mm256_shuffle_epi8(vtlo, lb), _mm256_shuffle_epi8(vthi, hb));
+    if (ident) {
+      sa = va;
+      sb = vb;
+    } else {
+      sa = _mm256_xor_si256(_mm256_shuffle_epi8(vslo, la), _mm256_shuffle_epi8(vshi, ha));
+      sb = _mm256_xor_si256(_mm256_shuffle_epi8(vslo, lb), _mm256_shuffle_epi8(vshi, hb));
+    }
+    ra = _mm256_xor_si256(sa, tb);
+    rb = _mm256_xor_si256(sb, ta);
+    if (nt) {
+      _mm256_stream_si256((__m256i *) (pa + i), ra);
+      _mm256_stream_si256((__m256i *) (pb + i), rb);
+    } else {
+      _mm256_storeu_si256((__m256i *) (pa + i), ra);
+      _mm256_storeu_si256((__m256i *) (pb + i), rb);
+    }
+  }
+  return i;
+}
+
+/* a <- a + 2b, b <- b + 2a.  Doubling a byte is a left shift, reduced by
+   XORing the low byte of the field polynomial into the lanes whose top bit
+   was set; cmpgt against zero picks those lanes out. */
+
+__attribute__((target("sse2")))
+static int clay_couple2_sse2(uint8_t *pa, uint8_t *pb, int len)
+{
+  __m128i zero, poly, va, vb, da, db;
+  int i;
+
+  zero = _mm_setzero_si128();
+  poly = _mm_set1_epi8(GF8_POLY & 0xff);
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    va = _mm_loadu_si128((__m128i *) (pa + i));
+    vb = _mm_loadu_si128((__m128i *) (pb + i));
+    da = _mm_xor_si128(_mm_add_epi8(va, va), _mm_and_si128(_mm_cmpgt_epi8(zero, va), poly));
+    db = _mm_xor_si128(_mm_add_epi8(vb, vb), _mm_and_si128(_mm_cmpgt_epi8(zero, vb), poly));
+    _mm_storeu_si128((__m128i *) (pa + i), _mm_xor_si128(va, db));
+    _mm_storeu_si128((__m128i *) (pb + i), _mm_xor_si128(vb, da));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static int clay_couple2_avx2(uint8_t *pa, uint8_t *pb, int len, int nt)
+{
+  __m256i zero, poly, va, vb, da, db;
+  int i;
+
+  zero = _mm256_setzero_si256();
+  poly = _mm256_set1_epi8(GF8_POLY & 0xff);
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    va = _mm256_loadu_si256((__m256i *) (pa + i));
+    vb = _mm256_loadu_si256((__m256i *) (pb + i));
+    da = _mm256_xor_si256(_mm256_add_epi8(va, va), _mm256_and_si256(_mm256_cmpgt_epi8(zero, va), poly));
+    db = _mm256_xor_si256(_mm256_add_epi8(vb, vb), _mm256_and_si256(_mm256_cmpgt_epi8(zero, vb), poly));
+    if (nt) {
+      _mm256_stream_si256((__m256i *) (pa + i), _mm256_xor_si256(va, db));
+      _mm256_stream_si256((__m256i *) (pb + i), _mm256_xor_si256(vb, da));
+    } else {
+      _mm256_storeu_si256((__m256i *) (pa + i), _mm256_xor_si256(va, db));
+      _mm256_storeu_si256((__m256i *) (pb + i), _mm256_xor_si256(vb, da));
+    }
+  }
+  return i;
+}
+
+__attribute__((target("avx512f,avx512bw,gfni")))
+static int clay_pair_gfni(uint8_t *pa, uint8_t *pb, const galois_w08_tables *s,
+                          const galois_w08_tables *t, int ident, int len, int nt)
+{
+  __m512i ms, mt, va, vb, sa, sb, ra, rb;
+  int i;
+
+  ms = _mm512_set1_epi64((long long) s->affine);
+  mt = _mm512_set1_epi64((long long) t->affine);
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    va = _mm512_loadu_si512((void *) (pa + i));
+    vb = _mm512_loadu_si512((void *) (pb + i));
+    if (ident) {
+      sa = va;
+      sb = vb;
+    } else {
+      sa = _mm512_gf2p8affine_epi64_epi8(va, ms, 0);
+      sb = _mm512_gf2p8affine_epi64_epi8(vb, ms, 0);
+    }
+    ra = _mm512_xor_si512(sa, _mm512_gf2p8affine_epi64_epi8(vb, mt, 0));
+    rb = _mm512_xor_si512(sb, _mm512_gf2p8affine_epi64_epi8(va, mt, 0));
+    if (nt) {
+      _mm512_stream_si512((void *) (pa + i), ra);
+      _mm512_stream_si512((void *) (pb + i), rb);
+    } else {
+      _mm512_storeu_si512((void *) (pa + i), ra);
+      _mm512_storeu_si512((void *) (pb + i), rb);
+    }
+  }
+  return i;
+}
+#endif
+
+/* Coupling by 2.  Returns 0 (and touches nothing) when the GFNI tier is
+   active, where the affine kernel is just as cheap. */
+
+static int clay_couple2(uint8_t *pa, uint8_t *pb, int len, int nt)
+{
+  uint8_t x, y;
+  int i;
+
+  i = 0;
+
+#ifdef CLAY_X86_DISPATCH
+  switch (galois_simd_level()) {
+  case GALOIS_SIMD_GFNI:
+    return 0;
+  case GALOIS_SIMD_AVX512:
+  case GALOIS_SIMD_AVX2:
+    i = clay_couple2_avx2(pa, pb, len, nt);
+    break;
+  case GALOIS_SIMD_SSSE3:
+    i = clay_couple2_sse2(pa, pb, len);
+    break;
+  }
+#endif
+
+  for (; i < len; i++) {
+    x = pa[i];
+    y = pb[i];
+    pa[i] = x ^ gf8_mul2(y);
+    pb[i] = y ^ gf8_mul2(x);
+  }
+  return 1;
+}
+
+static void clay_pair_transform(uint8_t *pa, uint8_t *pb, int s, int t, int len, int nt)
+{
+  const galois_w08_ctx *ctx;
+  const galois_w08_tables *st, *tt;
+  uint8_t x, y, sx, sy;
+  int ident;
+  int i;
+
+  if (s == 1 && t == 2 && clay_couple2(pa, pb, len, nt)) return;
+
+  ctx = galois_w08_ctx_default();
+  ident = (s == 1);
+  st = &ctx->mul[s & 0xff];
+  tt = &ctx->mul[t & 0xff];
+  i = 0;
+
+#ifdef CLAY_X86_DISPATCH
+  switch (galois_simd_level()) {
+  case GALOIS_SIMD_GFNI:
+    i = clay_pair_gfni(pa, pb, st, tt, ident, len, nt);
+    break;
+  case GALOIS_SIMD_AVX512:
+  case GALOIS_SIMD_AVX2:
+    i = clay_pair_avx2(pa, pb, st, tt, ident, len, nt);
+    break;
+  case GALOIS_SIMD_SSSE3:
+    i = clay_pair_ssse3(pa, pb, st, tt, ident, len);
+    break;
+  }
+#endif
+
+  for (; i < len; i++) {
+    x = pa[i];
+    y = pb[i];
+    sx = ident ? x : (st->lo[x & 0x0f] ^ st->hi[x >> 4]);
+    sy = ident ? y : (st->lo[y & 0x0f] ^ st->hi[y >> 4]);
+    pa[i] = sx ^ tt->lo[y & 0x0f] ^ tt->hi[y >> 4];
+    pb[i] = sy ^ tt->lo[x & 0x0f] ^ tt->hi[x >> 4];
+  }
+}
+
+void clay_couple_pair(char *a, char *b, int gamma, int len)
+{
+  clay_pair_transform((uint8_t *) a, (uint8_t *) b, 1, gamma, len, 0);
+}
+
+/* Streaming stores need a and b at the same offset from a 64-byte
+   boundary; otherwise, or below GALOIS_NT_MIN bytes or AVX2, this is
+   clay_couple_pair(). */
+
+void clay_couple_pair_nt(char *a, char *b, int gamma, int len)
+{
+  int head, body;
+
+  if (len < GALOIS_NT_MIN || galois_simd_level() < GALOIS_SIMD_AVX2 ||
+      (((uintptr_t) a ^ (uintptr_t) b) & 63) != 0) {
+    clay_couple_pair(a, b, gamma, len);
+    return;
+  }
+  head = (int) ((64 - ((uintptr_t) a & 63)) & 63);
+  body = (len - head) & ~63;
+  clay_couple_pair(a, b, gamma, head);
+  clay_pair_transform((uint8_t *) a + head, (uint8_t *) b + head, 1, gamma, body, 1);
+  clay_couple_pair(a + head + body, b + head + body, gamma, len - head - body);
+  galois_nt_fence();
+}
+
+/* The coupling matrix [[1, g], [g, 1]] has determinant 1 + g^2 = (1 + g)^2
+   in characteristic 2, so its inverse is [[1, g], [g, 1]] / (1 + g)^2. */
+
+void clay_decouple_pair(char *a, char *b, int gamma, int len)
+{
+  uint8_t det_inv;
+
+  det_inv = gf8_inv[gf8_mul(1 ^ gamma, 1 ^ gamma)];
+  clay_pair_transform((uint8_t *) a, (uint8_t *) b, det_inv, gf8_mul(gamma, det_inv), len, 0);
+}
+
+/* A coupler in bitmatrix mode runs the 2x2 transform as a 2w x 2w
+   bitmatrix over GF(2), turned into an XOR schedule once.  Both
+   sub-chunks of a w-packet group are copied aside first, since every
+   output packet reads packets of both inputs; the copy lives on the
+   stack, which bounds w*packetsize. */
+
+static int **clay_pair_schedule(int a00, int a01, int a10, int a11, int w)
+{
+  int matrix[4];
+  int *bitmatrix;
+  int **schedule;
+
+  matrix[0] = a00;
+  matrix[1] = a01;
+  matrix[2] = a10;
+  matrix[3] = a11;
+  bitmatrix = jerasure_matrix_to_bitmatrix(2, 2, w, matrix);
+  if (bitmatrix == NULL) return NULL;
+  schedule = jerasure_smart_bitmatrix_to_schedule(2, 2, w, bitmatrix);
+  free(bitmatrix);
+  return schedule;
+}
+
+clay_coupler *clay_coupler_new(int gamma, int w, int packetsize)
+{
+  clay_coupler *c;
+  int det_inv, gamma_inv, t;
+
+  c = (clay_coupler *) calloc(1, sizeof(clay_coupler));
+  if (c == NULL) return NULL;
+  c->gamma = gamma;
+  c->w = w;
+  c->packetsize = packetsize;
+  if (packetsize == 0) return c;
+  if (packetsize < 0 || w * packetsize > CLAY_COUPLER_MAX_GROUP) {
+    free(c);
+    return NULL;
+  }
+
+  det_inv = galois_single_divide(1, galois_single_multiply(1 ^ gamma, 1 ^ gamma, w), w);
+  t = galois_single_multiply(gamma, det_inv, w);
+  gamma_inv = galois_single_divide(1, gamma, w);
+  c->couple_ops = clay_pair_schedule(1, gamma, gamma, 1, w);
+  c->decouple_ops = clay_pair_schedule(det_inv, t, t, det_inv, w);
+  c->solve_ops = clay_pair_schedule(gamma_inv, gamma_inv, gamma_inv, gamma_inv ^ gamma, w);
+  t = galois_single_multiply(gamma, gamma, w);
+  c->swap_ops = clay_pair_schedule(1, gamma, gamma, 1 ^ t, w);
+  c->recouple_ops = clay_pair_schedule(1 ^ t, gamma, 0, 1, w);
+  c->add_ops = clay_pair_schedule(1, gamma, 0, 1, w);
+  if (c->couple_ops == NULL || c->decouple_ops == NULL || c->solve_ops == NULL ||
+      c->swap_ops == NULL || c->recouple_ops == NULL || c->add_ops == NULL) {
+    clay_coupler_free(c);
+    return NULL;
+  }
+  return c;
+}
+
+int clay_coupler_check(const clay_coupler *c, long len)
+{
+  if (c->packetsize == 0) return 0;
+  return (len % (c->w * c->packetsize) == 0) ? 0 : -1;
+}
+
+/* len has passed clay_coupler_check() */
+
+static void clay_coupler_run(const clay_coupler *c, int **ops, char *a, char *b, int len)
+{
+  long tmp[2 * CLAY_COUPLER_MAX_GROUP / sizeof(long)];
+  char *ptrs[4];
+  int group, off;
+
+  group = c->w * c->packetsize;
+  ptrs[0] = (char *) tmp;
+  ptrs[1] = (char *) tmp + group;
+  for (off = 0; off + group <= len; off += group) {
+    memcpy(ptrs[0], a + off, group);
+    memcpy(ptrs[1], b + off, group);
+    ptrs[2] = a + off;
+    ptrs[3] = b + off;
+    jerasure_do_scheduled_operations(ptrs, ops, c->packetsize);
+  }
+}
+
+void clay_coupler_couple(const clay_coupler *c, char *a, char *b, int len)
+{
+  if (c->packetsize != 0) {
+    clay_coupler_run(c, c->couple_ops, a, b, len);
+  } else if (c->nt) {
+    clay_couple_pair_nt(a, b, c->gamma, len);
+  } else {
+    clay_couple_pair(a, b, c->gamma, len);
+  }
+}
+
+void clay_coupler_decouple(const clay_coupler *c, char *a, char *b, int len)
+{
+  if (c->packetsize != 0) {
+    clay_coupler_run(c, c->decouple_ops, a, b, len);
+  } else {
+    clay_decouple_pair(a, b, c->gamma, len);
+  }
+}
+
+/* With a = C_x = U_x + g*U_y and b = U_x, U_y = (a + b)/g and
+   C_y = U_y + g*U_x = (a + b)/g + g*b. */
+
+void clay_coupler_solve(const clay_coupler *c, char *a, char *b, int len)
+{
+  const galois_w08_ctx *ctx;
+
+  if (c->packetsize != 0) {
+    clay_coupler_run(c, c->solve_ops, a, b, len);
+    return;
+  }
+  ctx = galois_w08_ctx_default();
+  galois_region_xor(b, a, len);
+  galois_w08_ctx_region_divide(ctx, a, c->gamma, len, NULL, 0);
+  galois_w08_ctx_region_multiply(ctx, b, c->gamma, len, NULL, 0);
+  galois_region_xor(a, b, len);
+}
+
+/* With a = C_x = U_x + g*U_y and b = U_y, U_x = a + g*b and
+   C_y = U_y + g*U_x. */
+
+void clay_coupler_swap(const clay_coupler *c, char *a, char *b, int len)
+{
+  const galois_w08_ctx *ctx;
+
+  if (c->packetsize != 0) {
+    clay_coupler_run(c, c->swap_ops, a, b, len);
+    return;
+  }
+  ctx = galois_w08_ctx_default();
+  galois_w08_ctx_region_multiply(ctx, b, c->gamma, len, a, 1);
+  galois_w08_ctx_region_multiply(ctx, a, c->gamma, len, b, 1);
+}
+
+/* With a = U_x and b = C_y = U_y + g*U_x, C_x = U_x + g*U_y =
+   (1 + g^2)*a + g*b. */
+
+void clay_coupler_recouple(const clay_coupler *c, char *a, char *b, int len)
+{
+  const galois_w08_ctx *ctx;
+
+  if (c->packetsize != 0) {
+    clay_coupler_run(c, c->recouple_ops, a, b, len);
+    return;
+  }
+  ctx = galois_w08_ctx_default();
+  galois_w08_ctx_region_multiply(ctx, a, 1 ^ gf8_mul(c->gamma, c->gamma), len, NULL, 0);
+  galois_w08_ctx_region_multiply(ctx, b, c->gamma, len, a, 1);
+}
+
+void clay_coupler_add(const clay_coupler *c, char *a, char *b, int len)
+{
+  if (c->packetsize != 0) {
+    clay_coupler_run(c, c->add_ops, a, b, len);
+    return;
+  }
+  galois_w08_ctx_region_multiply(galois_w08_ctx_default(), b, c->gamma, len, a, 1);
+}
+
+void clay_coupler_free(clay_coupler *c)
+{
+  if (c == NULL) return;
+  if (c->couple_ops != NULL) jerasure_free_schedule(c->couple_ops);
+  if (c->decouple_ops != NULL) jerasure_free_schedule(c->decouple_ops);
+  if (c->solve_ops != NULL) jerasure_free_schedule(c->solve_ops);
+  if (c->swap_ops != NULL) jerasure_free_schedule(c->swap_ops);
+  if (c->recouple_ops != NULL) jerasure_free_schedule(c->recouple_ops);
+  if (c->add_ops != NULL) jerasure_free_schedule(c->add_ops);
+  free(c);
+}
+
+/* Per-layer MDS decoding with a decoding matrix built once per erasure
+   pattern.  Erased data sub-chunks are dot products of k survivors with
+   rows of the inverted matrix; erased coding sub-chunks are re-encoded
+   from the (now complete) data with rows of the coding matrix. */
+
+clay_layer_decoder *clay_layer_decoder_new(int k, int m, int *matrix, int *erased)
+{
+  clay_layer_decoder *d;
+  int *decoding_matrix;
+  int *rows;
+  int i, j;
+
+  d = (clay_layer_decoder *) calloc(1, sizeof(clay_layer_decoder));
+  if (d == NULL) return NULL;
+  d->k = k;
+  d->m = m;
+  d->ids = (int *) malloc(sizeof(int) * (k + m));
+  d->src_ids = (int *) malloc(sizeof(int) * k);
+  rows = (int *) malloc(sizeof(int) * k * m);
+  decoding_matrix = (int *) malloc(sizeof(int) * k * k);
+  if (d->ids == NULL || d->src_ids == NULL || rows == NULL || decoding_matrix == NULL) {
+    free(rows);
+    free(decoding_matrix);
+    clay_layer_decoder_free(d);
+    return NULL;
+  }
+
+  for (i = 0; i < k; i++) {
+    if (erased[i]) d->ids[d->ndata++] = i;
+  }
+  for (i = k; i < k + m; i++) {
+    if (erased[i]) d->ids[d->ndata + d->ncoding++] = i;
+  }
+  if (d->ndata + d->ncoding > m) goto fail;
+
+  if (d->ndata > 0) {
+    if (jerasure_make_decoding_matrix(k, m, 8, matrix, erased, decoding_matrix, d->src_ids) < 0) {
+      goto fail;
+    }
+    for (i = 0; i < d->ndata; i++) {
+      memcpy(rows + i * k, decoding_matrix + d->ids[i] * k, sizeof(int) * k);
+    }
+    d->data_tables = galois_w08_dot_prod_init(k, d->ndata, rows);
+    if (d->data_tables == NULL) goto fail;
+  } else {
+    for (i = 0; i < k; i++) d->src_ids[i] = i;
+  }
+
+  if (d->ncoding > 0) {
+    for (i = 0; i < d->ncoding; i++) {
+      j = d->ids[d->ndata + i] - k;
+      memcpy(rows + i * k, matrix + j * k, sizeof(int) * k);
+    }
+    d->coding_tables = galois_w08_dot_prod_init(k, d->ncoding, rows);
+    if (d->coding_tables == NULL) goto fail;
+  }
+
+  free(rows);
+  free(decoding_matrix);
+  return d;
+
+fail:
+  free(rows);
+  free(decoding_matrix);
+  clay_layer_decoder_free(d);
+  return NULL;
+}
+
+int clay_layer_decode(const clay_layer_decoder *d, char **data, char **coding, int size)
+{
+  char *src[d->k];
+  char *dest[d->m];
+  int i;
+
+  if (d->ndata > 0) {
+    for (i = 0; i < d->k; i++) {
+      src[i] = (d->src_ids[i] < d->k) ? data[d->src_ids[i]] : coding[d->src_ids[i] - d->k];
+    }
+    for (i = 0; i < d->ndata; i++) dest[i] = data[d->ids[i]];
+    galois_w08_region_dot_prod(d->k, d->ndata, d->data_tables, src, dest, size);
+  }
+  if (d->ncoding > 0) {
+    for (i = 0; i < d->ncoding; i++) dest[i] = coding[d->ids[d->ndata + i] - d->k];
+    galois_w08_region_dot_prod(d->k, d->ncoding, d->coding_tables, data, dest, size);
+  }
+  return 0;
+}
+
+void clay_layer_decoder_free(clay_layer_decoder *d)
+{
+  if (d == NULL) return;
+  free(d->ids);
+  free(d->src_ids);
+  free(d->data_tables);
+  free(d->coding_tables);
+  free(d);
+}
+
+/* Decoders are found through a chained hash on the erasure bitmap and
+   kept on a list from most to least recently used; a miss past capacity
+   evicts the least recently used one no caller holds. */
+
+typedef struct clay_decoder_entry {
+  unsigned long long key;
+  clay_layer_decoder *d;
+  int refs;
+  struct clay_decoder_entry *next;    /* hash chain */
+  struct clay_decoder_entry *newer;
+  struct clay_decoder_entry *older;
+} clay_decoder_entry;
+
+struct clay_decoder_cache {
+  int k, m;
+  int *matrix;
+  int capacity;
+  int count;
+  int nbuckets;                       /* a power of 2 */
+  clay_decoder_entry **buckets;
+  clay_decoder_entry *newest;
+  clay_decoder_entry *oldest;
+  pthread_mutex_t lock;
+};
+
+clay_decoder_cache *clay_decoder_cache_new(int k, int m, int *matrix, int capacity)
+{
+  clay_decoder_cache *c;
+
+  if (k + m > 64) return NULL;
+  if (capacity <= 0) capacity = CLAY_DECODER_CACHE_DEFAULT;
+  c = (clay_decoder_cache *) calloc(1, sizeof(clay_decoder_cache));
+  if (c == NULL) return NULL;
+  c->k = k;
+  c->m = m;
+  c->capacity = capacity;
+  for (c->nbuckets = 1; c->nbuckets < capacity; c->nbuckets *= 2) ;
+  c->matrix = (int *) malloc(sizeof(int) * k * m);
+  c->buckets = (clay_decoder_entry **) calloc(c->nbuckets, sizeof(clay_decoder_entry *));
+  if (c->matrix == NULL || c->buckets == NULL) {
+    free(c->matrix);
+    free(c->buckets);
+    free(c);
+    return NULL;
+  }
+  memcpy(c->matrix, matrix, sizeof(int) * k * m);
+  pthread_mutex_init(&c->lock, NULL);
+  return c;
+}
+
+static clay_decoder_entry **clay_decoder_cache_slot(clay_decoder_cache *c, unsigned long long key)
+{
+  clay_decoder_entry **e;
+
+  e = &c->buckets[(key * 0x9e3779b97f4a7c15ULL >> 32) & (c->nbuckets - 1)];
+  while (*e != NULL && (*e)->key != key) e = &(*e)->next;
+  return e;
+}
+
+static void clay_decoder_cache_unlink(clay_decoder_cache *c, clay_decoder_entry *e)
+{
+  if (e->newer != NULL) e->newer->older = e->older; else c->newest = e->older;
+  if (e->older != NULL) e->older->newer = e->newer; else c->oldest = e->newer;
+}
+
+static void clay_decoder_cache_push(clay_decoder_cache *c, clay_decoder_entry *e)
+{
+  e->newer = NULL;
+  e->older = c->newest;
+  if (c->newest != NULL) c->newest->newer = e; else c->oldest = e;
+  c->newest = e;
+}
+
+/* Drops the least recently used decoder nobody holds; 0 if all are held */
+
+static int clay_decoder_cache_evict(clay_decoder_cache *c)
+{
+  clay_decoder_entry *e;
+
+  for (e = c->oldest; e != NULL && e->refs > 0; e = e->newer) ;
+  if (e == NULL) return 0;
+  *clay_decoder_cache_slot(c, e->key) = e->next;
+  clay_decoder_cache_unlink(c, e);
+  clay_layer_decoder_free(e->d);
+  free(e);
+  c->count--;
+  return 1;
+}
+
+static unsigned long long clay_decoder_cache_key(int n, const int *erased)
+{
+  unsigned long long key;
+  int i;
+
+  key = 0;
+  for (i = 0; i < n; i++) {
+    if (erased[i]) key |= 1ULL << i;
+  }
+  return key;
+}
+
+const clay_layer_decoder *clay_decoder_cache_get(clay_decoder_cache *c, int *erased)
+{
+  clay_decoder_entry **slot, *e;
+  clay_layer_decoder *d;
+  unsigned long long key;
+
+  key = clay_decoder_cache_key(c->k + c->m, erased);
+  pthread_mutex_lock(&c->lock);
+  slot = clay_decoder_cache_slot(c, key);
+  e = *slot;
+  if (e != NULL) {
+    clay_decoder_cache_unlink(c, e);
+    clay_decoder_cache_push(c, e);
+    e->refs++;
+    pthread_mutex_unlock(&c->lock);
+    return e->d;
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  /* Inverted outside the lock; a racing miss on the same pattern keeps
+     whichever decoder got in first */
+  d = clay_layer_decoder_new(c->k, c->m, c->matrix, erased);
+  if (d == NULL) return NULL;
+
+  pthread_mutex_lock(&c->lock);
+  slot = clay_decoder_cache_slot(c, key);
+  if (*slot != NULL) {
+    e = *slot;
+    clay_decoder_cache_unlink(c, e);
+    clay_decoder_cache_push(c, e);
+    e->refs++;
+    pthread_mutex_unlock(&c->lock);
+    clay_layer_decoder_free(d);
+    return e->d;
+  }
+  if (c->count >= c->capacity && clay_decoder_cache_evict(c)) {
+    slot = clay_decoder_cache_slot(c, key);
+  }
+  e = (clay_decoder_entry *) calloc(1, sizeof(clay_decoder_entry));
+  if (e == NULL) {
+    pthread_mutex_unlock(&c->lock);
+    clay_layer_decoder_free(d);
+    return NULL;
+  }
+  e->key = key;
+  e->d = d;
+  e->refs = 1;
+  *slot = e;
+  clay_decoder_cache_push(c, e);
+  c->count++;
+  pthread_mutex_unlock(&c->lock);
+  return d;
+}
+
+void clay_decoder_cache_put(clay_decoder_cache *c, const clay_layer_decoder *d)
+{
+  clay_decoder_entry *e;
+  unsigned long long key;
+  int i;
+
+  if (d == NULL) return;
+  key = 0;
+  for (i = 0; i < d->ndata + d->ncoding; i++) key |= 1ULL << d->ids[i];
+  pthread_mutex_lock(&c->lock);
+  e = *clay_decoder_cache_slot(c, key);
+  e->refs--;
+  while (c->count > c->capacity && clay_decoder_cache_evict(c)) ;
+  pthread_mutex_unlock(&c->lock);
+}
+
+int clay_decoder_cache_fill(clay_decoder_cache *c, int maxerased)
+{
+  const clay_layer_decoder *d;
+  int erased[64];
+  int pos[64];
+  int n, e, i, built;
+
+  n = c->k + c->m;
+  if (maxerased > c->m) maxerased = c->m;
+  built = 0;
+  for (e = 1; e <= maxerased; e++) {
+    /* The e-subsets of the nodes in lexicographic order */
+    for (i = 0; i < e; i++) pos[i] = i;
+    for (;;) {
+      if (built >= c->capacity) return built;
+      memset(erased, 0, sizeof(int) * n);
+      for (i = 0; i < e; i++) erased[pos[i]] = 1;
+      d = clay_decoder_cache_get(c, erased);
+      if (d == NULL) return -1;
+      clay_decoder_cache_put(c, d);
+      built++;
+
+      for (i = e - 1; i >= 0 && pos[i] == n - e + i; i--) ;
+      if (i < 0) break;
+      pos[i]++;
+      for (i++; i < e; i++) pos[i] = pos[i - 1] + 1;
+    }
+  }
+  return built;
+}
+
+void clay_decoder_cache_free(clay_decoder_cache *c)
+{
+  clay_decoder_entry *e, *older;
+
+  if (c == NULL) return;
+  for (e = c->newest; e != NULL; e = older) {
+    older = e->older;
+    clay_layer_decoder_free(e->d);
+    free(e);
+  }
+  pthread_mutex_destroy(&c->lock);
+  free(c->buckets);
+  free(c->matrix);
+  free(c);
+}
+
+static clay_plan *clay_plan_build(const clay_code *c, const int *use, int lost, int nlayers);
+
+/* Node i sits at (x, y) = (i % q, i / q) and layer z has digits
+   z_y = (z / q^y) % q.  Sub-chunk (i, z) is coupled exactly when
+   z_y != x, with node (z_y, y) in the layer whose digit y is x. */
+
+clay_code *clay_code_new(int n, int k, int d)
+{
+  clay_code *c;
+  int i, y, z;
+
+  if (k <= 0 || d <= k || d >= n) return NULL;
+  if (n % (d - k + 1) != 0) return NULL;
+
+  c = (clay_code *) calloc(1, sizeof(clay_code));
+  if (c == NULL) return NULL;
+  c->n = n;
+  c->k = k;
+  c->m = n - k;
+  c->d = d;
+  c->q = d - k + 1;
+  c->t = n / c->q;
+  c->alpha = 1;
+  for (y = 0; y < c->t; y++) {
+    if (c->alpha > CLAY_MAX_ALPHA / c->q) {
+      clay_code_free(c);
+      return NULL;
+    }
+    c->alpha *= c->q;
+  }
+
+  c->x = (int *) malloc(sizeof(int) * n);
+  c->y = (int *) malloc(sizeof(int) * n);
+  c->pow = (int *) malloc(sizeof(int) * (c->t + 1));
+  c->digit = (int *) malloc(sizeof(int) * c->alpha * c->t);
+  if (c->x == NULL || c->y == NULL || c->pow == NULL || c->digit == NULL) {
+    clay_code_free(c);
+    return NULL;
+  }
+  for (i = 0; i < n; i++) {
+    c->x[i] = i % c->q;
+    c->y[i] = i / c->q;
+  }
+  c->pow[0] = 1;
+  for (y = 0; y < c->t; y++) c->pow[y + 1] = c->pow[y] * c->q;
+  for (z = 0; z < c->alpha; z++) {
+    for (y = 0; y < c->t; y++) c->digit[z * c->t + y] = (z / c->pow[y]) % c->q;
+  }
+  c->plan = clay_plan_build(c, NULL, -1, c->alpha);
+  if (c->plan == NULL) {
+    clay_code_free(c);
+    return NULL;
+  }
+  return c;
+}
+
+void clay_code_free(clay_code *c)
+{
+  if (c == NULL) return;
+  free(c->x);
+  free(c->y);
+  free(c->pow);
+  free(c->digit);
+  clay_plan_free(c->plan);
+  free(c);
+}
+
+char *clay_code_subchunk(const clay_code *c, char **fdata, char **fcoding,
+                         int node, int z, int blocksize)
+{
+  long stride;
+
+  stride = (c->stride != 0) ? c->stride : blocksize;
+  if (node < c->k) return fdata[z] + node * stride;
+  return fcoding[z] + (node - c->k) * stride;
+}
+
+int clay_code_partner(const clay_code *c, int node, int z, int *pz)
+{
+  int x, y, zy;
+
+  x = c->x[node];
+  y = c->y[node];
+  zy = c->digit[z * c->t + y];
+  if (zy == x) return -1;
+  *pz = z + (x - zy) * c->pow[y];
+  return y * c->q + zy;
+}
+
+/* A plan lists each pair once, from the node whose x is above its
+   partner's; that node's layer is the lower of the two, so the items come
+   out sorted by it and a pass walks the layers front to back.  Only pairs
+   with a node in use[] (all when use is NULL) are listed, from all
+   nlayers layers or, with lost >= 0, from lost's repair layers. */
+
+static clay_plan *clay_plan_build(const clay_code *c, const int *use, int lost, int nlayers)
+{
+  clay_plan *p;
+  clay_pair *pr;
+  int i, j, z, b, zb, n;
+
+  p = (clay_plan *) calloc(1, sizeof(clay_plan));
+  if (p == NULL) return NULL;
+  for (n = 0; n < 2; n++) {
+    for (j = 0; j < nlayers; j++) {
+      z = (lost < 0) ? j : clay_code_repair_layer(c, lost, j);
+      for (i = 0; i < c->n; i++) {
+        b = clay_code_partner(c, i, z, &zb);
+        if (b < 0 || c->x[b] > c->x[i]) continue;
+        if (use != NULL && !use[i] && !use[b]) continue;
+        if (n == 1) {
+          pr = p->pairs + p->npairs;
+          pr->a = i;
+          pr->za = z;
+          pr->b = b;
+          pr->zb = zb;
+        }
+        p->npairs++;
+      }
+    }
+    if (n == 0) {
+      p->pairs = (clay_pair *) malloc(sizeof(clay_pair) * (p->npairs > 0 ? p->npairs : 1));
+      if (p->pairs == NULL) {
+        free(p);
+        return NULL;
+      }
+      p->npairs = 0;
+    }
+  }
+  return p;
+}
+
+/* Coupling is bytewise (or w-packet-groupwise), so running a plan over
+   bytes [off, off+len) of every sub-chunk is exact. */
+
+#define CLAY_OP_COUPLE    0
+#define CLAY_OP_DECOUPLE  1
+#define CLAY_OP_SWAP      2
+#define CLAY_OP_RECOUPLE  3
+#define CLAY_OP_ADD       4
+
+static void clay_plan_run(const clay_plan *p, const clay_code *c, const clay_coupler *cp,
+                          char **fdata, char **fcoding, int blocksize, int first, int npairs,
+                          int off, int len, int op)
+{
+  const clay_pair *pr;
+  char *a, *b;
+  int i;
+
+  for (i = first; i < first + npairs; i++) {
+    pr = p->pairs + i;
+    a = clay_code_subchunk(c, fdata, fcoding, pr->a, pr->za, blocksize) + off;
+    b = clay_code_subchunk(c, fdata, fcoding, pr->b, pr->zb, blocksize) + off;
+    switch (op) {
+    case CLAY_OP_COUPLE:
+      clay_coupler_couple(cp, a, b, len);
+      break;
+    case CLAY_OP_DECOUPLE:
+      clay_coupler_decouple(cp, a, b, len);
+      break;
+    case CLAY_OP_SWAP:
+      clay_coupler_swap(cp, a, b, len);
+      break;
+    case CLAY_OP_RECOUPLE:
+      clay_coupler_recouple(cp, a, b, len);
+      break;
+    case CLAY_OP_ADD:
+      clay_coupler_add(cp, a, b, len);
+      break;
+    }
+  }
+}
+
+void clay_plan_couple(const clay_plan *p, const clay_code *c, const clay_coupler *cp,
+                      char **fdata, char **fcoding, int blocksize)
+{
+  clay_plan_run(p, c, cp, fdata, fcoding, blocksize, 0, p->npairs, 0, blocksize, CLAY_OP_COUPLE);
+}
+
+void clay_plan_decouple(const clay_plan *p, const clay_code *c, const clay_coupler *cp,
+                        char **fdata, char **fcoding, int blocksize)
+{
+  clay_plan_run(p, c, cp, fdata, fcoding, blocksize, 0, p->npairs, 0, blocksize, CLAY_OP_DECOUPLE);
+}
+
+void clay_plan_couple_tile(const clay_plan *p, const clay_code *c, const clay_coupler *cp,
+                           char **fdata, char **fcoding, int blocksize, int off, int len)
+{
+  clay_plan_run(p, c, cp, fdata, fcoding, blocksize, 0, p->npairs, off, len, CLAY_OP_COUPLE);
+}
+
+
+void clay_plan_free(clay_plan *p)
+{
+  if (p == NULL) return;
+  free(p->pairs);
+  free(p);
+}
+
+/* Pair i lists under both of its layers.  pending[i] counts its layers
+   not yet final; whoever brings it to 0 saw the other layer's release and
+   couples the pair. */
+
+clay_deps *clay_deps_new(const clay_plan *p, int nlayers)
+{
+  clay_deps *d;
+  int *fill;
+  int i, z;
+
+  d = (clay_deps *) calloc(1, sizeof(clay_deps));
+  if (d == NULL) return NULL;
+  d->plan = p;
+  d->nlayers = nlayers;
+  d->first = (int *) calloc(nlayers + 1, sizeof(int));
+  d->pairs = (int *) malloc(sizeof(int) * (2 * p->npairs + 1));
+  d->pending = (int *) malloc(sizeof(int) * (p->npairs + 1));
+  fill = (int *) calloc(nlayers, sizeof(int));
+  if (d->first == NULL || d->pairs == NULL || d->pending == NULL || fill == NULL) {
+    free(fill);
+    clay_deps_free(d);
+    return NULL;
+  }
+
+  for (i = 0; i < p->npairs; i++) {
+    d->first[p->pairs[i].za + 1]++;
+    d->first[p->pairs[i].zb + 1]++;
+  }
+  for (z = 0; z < nlayers; z++) d->first[z + 1] += d->first[z];
+  for (i = 0; i < p->npairs; i++) {
+    z = p->pairs[i].za;
+    d->pairs[d->first[z] + fill[z]++] = i;
+    z = p->pairs[i].zb;
+    d->pairs[d->first[z] + fill[z]++] = i;
+  }
+  free(fill);
+  clay_deps_reset(d);
+  return d;
+}
+
+void clay_deps_reset(clay_deps *d)
+{
+  int i;
+
+  for (i = 0; i < d->plan->npairs; i++) d->pending[i] = 2;
+}
+
+void clay_deps_layer_done(clay_deps *d, int z, const clay_code *c, const clay_coupler *cp,
+                          char **fdata, char **fcoding, int blocksize)
+{
+  int i, pr;
+
+  for (i = d->first[z]; i < d->first[z + 1]; i++) {
+    pr = d->pairs[i];
+    if (__atomic_sub_fetch(&d->pending[pr], 1, __ATOMIC_ACQ_REL) == 0) {
+      clay_plan_run(d->plan, c, cp, fdata, fcoding, blocksize, pr, 1, 0, blocksize, CLAY_OP_COUPLE);
+    }
+  }
+}
+
+void clay_deps_free(clay_deps *d)
+{
+  if (d == NULL) return;
+  free(d->first);
+  free(d->pairs);
+  free(d->pending);
+  free(d);
+}
+
+void clay_code_couple(const clay_code *c, const clay_coupler *cp, char **fdata,
+                      char **fcoding, int blocksize)
+{
+  clay_plan_couple(c->plan, c, cp, fdata, fcoding, blocksize);
+}
+
+void clay_code_decouple(const clay_code *c, const clay_coupler *cp, char **fdata,
+                        char **fcoding, int blocksize)
+{
+  clay_plan_decouple(c->plan, c, cp, fdata, fcoding, blocksize);
+}
+
+/* Each pair gets its operations once per pattern.  A pair of two
+   survivors is decoupled before the layers of its score (both layers have
+   the same one) and, if wanted, coupled back at the end.  In a mixed pair
+   the erased node is uncoupled in the survivor's layer and the survivor
+   in the erased node's, so the survivor's layer scores one more; the pair
+   is worked on before the survivor's layer.  If the erased node is
+   wanted it is swapped, and the survivor recoupled at the end if wanted
+   too; otherwise a += g*b takes the survivor to U and, at the end, back
+   to C.  A pair of two erased nodes is coupled after its layers.  With
+   only one side of a pair wanted, a += g*b couples that side alone. */
+
+static void clay_decode_pair(const clay_code *c, const clay_pair *pr, const int *erased,
+                             const int *want, const int *score, int nscores,
+                             clay_pair *steps, int *ops, int *key, int *nsteps)
+{
+  clay_pair rev;
+  int wa, wb, n;
+
+  rev.a = pr->b;
+  rev.za = pr->zb;
+  rev.b = pr->a;
+  rev.zb = pr->za;
+  if (erased[pr->a] && !erased[pr->b]) {
+    clay_decode_pair(c, &rev, erased, want, score, nscores, steps, ops, key, nsteps);
+    return;
+  }
+  wa = (want == NULL || want[pr->a]);
+  wb = (want == NULL || want[pr->b]);
+  n = 0;
+
+  if (!erased[pr->b]) {
+    steps[n] = *pr;
+    ops[n] = CLAY_OP_DECOUPLE;
+    key[n++] = 2 * score[pr->za];
+  } else if (!erased[pr->a]) {
+    steps[n] = *pr;
+    ops[n] = wb ? CLAY_OP_SWAP : CLAY_OP_ADD;
+    key[n++] = 2 * score[pr->za];
+    if (wa) {
+      steps[n] = *pr;
+      ops[n] = wb ? CLAY_OP_RECOUPLE : CLAY_OP_ADD;
+      key[n++] = 2 * nscores;
+    }
+    *nsteps = n;
+    return;
+  }
+
+  /* both survivors at the end, or both erased after their layers */
+  if (wa || wb) {
+    steps[n] = wa ? *pr : rev;
+    ops[n] = (wa && wb) ? CLAY_OP_COUPLE : CLAY_OP_ADD;
+    key[n++] = erased[pr->a] ? 2 * score[pr->za] + 1 : 2 * nscores;
+  }
+  *nsteps = n;
+}
+
+clay_decode_plan *clay_code_decode_plan(const clay_code *c, const int *erased, const int *want)
+{
+  clay_decode_plan *p;
+  clay_pair steps[2];
+  int ops[2], key[2];
+  int *score, *fill;
+  int i, j, z, s, nerased, nkeys, nsteps, pass;
+
+  nerased = 0;
+  for (i = 0; i < c->n; i++) nerased += (erased[i] != 0);
+  if (nerased > c->m) return NULL;
+
+  p = (clay_decode_plan *) calloc(1, sizeof(clay_decode_plan));
+  score = (int *) calloc(c->alpha, sizeof(int));
+  if (p == NULL || score == NULL) {
+    free(p);
+    free(score);
+    return NULL;
+  }
+  for (z = 0; z < c->alpha; z++) {
+    for (i = 0; i < c->n; i++) {
+      if (erased[i] && c->digit[z * c->t + c->y[i]] == c->x[i]) score[z]++;
+    }
+    if (score[z] + 1 > p->nscores) p->nscores = score[z] + 1;
+  }
+
+  nkeys = 2 * p->nscores + 1;
+  p->layers = (int *) malloc(sizeof(int) * c->alpha);
+  p->first = (int *) calloc(p->nscores + 1, sizeof(int));
+  p->steps = (clay_plan *) calloc(1, sizeof(clay_plan));
+  if (p->steps != NULL) {
+    p->steps->pairs = (clay_pair *) malloc(sizeof(clay_pair) * (2 * c->plan->npairs + 1));
+  }
+  p->ops = (int *) malloc(sizeof(int) * (2 * c->plan->npairs + 1));
+  p->start = (int *) calloc(nkeys + 1, sizeof(int));
+  fill = (int *) calloc(nkeys + 1, sizeof(int));
+  if (p->layers == NULL || p->first == NULL || p->steps == NULL || p->steps->pairs == NULL ||
+      p->ops == NULL || p->start == NULL || fill == NULL) {
+    free(score);
+    free(fill);
+    clay_decode_plan_free(p);
+    return NULL;
+  }
+
+  for (z = 0; z < c->alpha; z++) p->first[score[z] + 1]++;
+  for (s = 0; s < p->nscores; s++) p->first[s + 1] += p->first[s];
+  for (z = 0; z < c->alpha; z++) p->layers[p->first[score[z]] + fill[score[z]]++] = z;
+
+  /* Counted on the first pass, placed on the second */
+  memset(fill, 0, sizeof(int) * (nkeys + 1));
+  for (pass = 0; pass < 2; pass++) {
+    for (i = 0; i < c->plan->npairs; i++) {
+      clay_decode_pair(c, c->plan->pairs + i, erased, want, score, p->nscores, steps, ops, key,
+                       &nsteps);
+      for (j = 0; j < nsteps; j++) {
+        if (pass == 0) {
+          p->start[key[j] + 1]++;
+        } else {
+          p->steps->pairs[p->start[key[j]] + fill[key[j]]] = steps[j];
+          p->ops[p->start[key[j]] + fill[key[j]]++] = ops[j];
+        }
+      }
+    }
+    if (pass == 0) {
+      for (j = 0; j < nkeys; j++) p->start[j + 1] += p->start[j];
+    }
+  }
+  p->steps->npairs = p->start[nkeys];
+  free(score);
+  free(fill);
+  return p;
+}
+
+static void clay_decode_run(const clay_decode_plan *p, const clay_code *c, const clay_coupler *cp,
+                            char **fdata, char **fcoding, int blocksize, int from, int to,
+                            int off, int len)
+{
+  int i;
+
+  for (i = from; i < to; i++) {
+    clay_plan_run(p->steps, c, cp, fdata, fcoding, blocksize, i, 1, off, len, p->ops[i]);
+  }
+}
+
+void clay_code_decode(const clay_decode_plan *p, const clay_code *c, const clay_coupler *cp,
+                      char **fdata, char **fcoding, int blocksize, int off, int len,
+                      clay_layer_fn decode_layer, void *arg)
+{
+  int s, i;
+
+  for (s = 0; s < p->nscores; s++) {
+    clay_decode_run(p, c, cp, fdata, fcoding, blocksize, p->start[2 * s], p->start[2 * s + 1],
+                    off, len);
+    for (i = p->first[s]; i < p->first[s + 1]; i++) decode_layer(arg, p->layers[i], off, len);
+    clay_decode_run(p, c, cp, fdata, fcoding, blocksize, p->start[2 * s + 1],
+                    p->start[2 * s + 2], off, len);
+  }
+  clay_decode_run(p, c, cp, fdata, fcoding, blocksize, p->start[2 * p->nscores],
+                  p->start[2 * p->nscores + 1], off, len);
+}
+
+void clay_decode_plan_free(clay_decode_plan *p)
+{
+  if (p == NULL) return;
+  free(p->layers);
+  free(p->first);
+  clay_plan_free(p->steps);
+  free(p->ops);
+  free(p->start);
+  free(p);
+}
+
+/* Repairing node (x0, y0) reads the layers with z_y0 = x0.  In those
+   layers the other nodes of row y0 are coupled with the lost node, so
+   they are decoded along with it; the k other helpers are whole rows,
+   which keeps every pair they are in between two helpers. */
+
+int clay_code_helpers(const clay_code *c, int lost, int *helper)
+{
+  int i, y, rows;
+
+  if (c->k % c->q != 0) return -1;
+  for (i = 0; i < c->n; i++) helper[i] = (c->y[i] == c->y[lost] && i != lost);
+  rows = c->k / c->q;
+  for (y = 0; y < c->t && rows > 0; y++) {
+    if (y == c->y[lost]) continue;
+    for (i = y * c->q; i < (y + 1) * c->q; i++) helper[i] = 1;
+    rows--;
+  }
+  return 0;
+}
+
+int clay_code_repair_layer(const clay_code *c, int lost, int i)
+{
+  int y;
+
+  y = c->y[lost];
+  return (i / c->pow[y]) * c->pow[y + 1] + c->x[lost] * c->pow[y] + i % c->pow[y];
+}
+
+clay_plan *clay_code_data_plan(const clay_code *c)
+{
+  int *use;
+  clay_plan *p;
+  int i;
+
+  use = (int *) malloc(sizeof(int) * c->n);
+  if (use == NULL) return NULL;
+  for (i = 0; i < c->n; i++) use[i] = (i < c->k);
+  p = clay_plan_build(c, use, -1, c->alpha);
+  free(use);
+  return p;
+}
+
+/* The helpers outside the lost node's row are whole rows, so their
+   pairs in the repair layers are between two helpers. */
+
+clay_plan *clay_code_repair_plan(const clay_code *c, int lost, const int *helper)
+{
+  int *use;
+  clay_plan *p;
+  int i;
+
+  use = (int *) malloc(sizeof(int) * c->n);
+  if (use == NULL) return NULL;
+  for (i = 0; i < c->n; i++) use[i] = helper[i] && c->y[i] != c->y[lost];
+  p = clay_plan_build(c, use, lost, c->alpha / c->q);
+  free(use);
+  return p;
+}
+
+/* In repair layer z the lost node is uncoupled, so the decoded U is its
+   sub-chunk.  Its sub-chunk in the layer with z_y0 = x is coupled with
+   node (x, y0) at z, whose C was read and whose U is u[x]; u[x] is
+   overwritten. */
+
+void clay_code_repair_finish(const clay_code *c, const clay_coupler *cp, int lost, int z,
+                             char **u, char **fdata, char **fcoding, int blocksize)
+{
+  char *out;
+  int x, y, node;
+
+  y = c->y[lost];
+  for (x = 0; x < c->q; x++) {
+    if (x == c->x[lost]) continue;
+    node = y * c->q + x;
+    out = clay_code_subchunk(c, fdata, fcoding, lost, z + (x - c->x[lost]) * c->pow[y], blocksize);
+    memcpy(out, u[x], blocksize);
+    memcpy(u[x], clay_code_subchunk(c, fdata, fcoding, node, z, blocksize), blocksize);
+    clay_coupler_solve(cp, u[x], out, blocksize);
+  }
+}
@@ -0,0 +1,280 @@
+/* clay.h
+ * Region kernels for the Clay pairwise coupling transform.
+ *
+ * A coupled pair (a, b) is two sub-chunks of the same width: node x at
+ * layer z and its partner node at layer z' (see clay_code below).  Coupling
+ * replaces them with
+ *
+ *     a' = a + gamma * b
+ *     b' = b + gamma * a
+ *
+ * over GF(2^8).  Decoupling applies the inverse 2x2 matrix and restores
+ * (a, b) from (a', b'); gamma must not be 0 or 1.  Both sub-chunks are read
+ * once and written once, in place.
+ */
+
+#ifndef _CLAY_H
+#define _CLAY_H
+
+#include "galois_ext.h"
+
+extern void clay_couple_pair(char *a, char *b, int gamma, int len);
+extern void clay_decouple_pair(char *a, char *b, int gamma, int len);
+
+/* clay_couple_pair() with non-temporal stores, for final coupled
+   sub-chunks that are only written out afterwards (see
+   galois_w08_ctx_region_multiply_nt()). */
+
+extern void clay_couple_pair_nt(char *a, char *b, int gamma, int len);
+
+/* A coupler fixes gamma and how sub-chunks are represented.  With
+   packetsize 0 they are GF(2^8) byte strings and the kernels above are
+   used (nt selects clay_couple_pair_nt() for coupling).  With packetsize
+   > 0 they are in Jerasure's bitmatrix layout, as the cauchy base codes
+   produce: groups of w packets of packetsize bytes, packet j holding bit
+   j of every w-bit word.  The transform is then an XOR schedule;
+   w*packetsize may be at most CLAY_COUPLER_MAX_GROUP (clay_coupler_new()
+   returns NULL otherwise) and region lengths must be multiples of it,
+   which clay_coupler_check() tells once for a layout (0 if fine, -1 if
+   not).  A coupler is not modified by use and may be shared between
+   threads. */
+
+#define CLAY_COUPLER_MAX_GROUP (64 << 10)
+
+typedef struct {
+  int gamma;
+  int w;
+  int packetsize;
+  int nt;
+  int **couple_ops;                   /* XOR schedules: (a, b) copies -> (a, b) */
+  int **decouple_ops;
+  int **solve_ops;
+  int **swap_ops;
+  int **recouple_ops;
+  int **add_ops;
+} clay_coupler;
+
+extern clay_coupler *clay_coupler_new(int gamma, int w, int packetsize);
+extern int clay_coupler_check(const clay_coupler *c, long len);
+extern void clay_coupler_couple(const clay_coupler *c, char *a, char *b, int len);
+extern void clay_coupler_decouple(const clay_coupler *c, char *a, char *b, int len);
+extern void clay_coupler_free(clay_coupler *c);
+
+/* For a pair of nodes x and y, given a = x's coupled sub-chunk and b = x's
+   uncoupled one, replaces a with y's uncoupled and b with y's coupled
+   sub-chunk.  Repair uses this for the lost node's coupled sub-chunks. */
+
+extern void clay_coupler_solve(const clay_coupler *c, char *a, char *b, int len);
+
+/* For a pair of nodes x and y, given a = x's coupled and b = y's
+   uncoupled sub-chunk, clay_coupler_swap() replaces a with x's uncoupled
+   and b with y's coupled sub-chunk.  clay_coupler_recouple() takes that
+   result back to x's coupled sub-chunk in a, leaving b.  Erasure decoding
+   uses them for pairs of a survivor x and an erased node y. */
+
+extern void clay_coupler_swap(const clay_coupler *c, char *a, char *b, int len);
+extern void clay_coupler_recouple(const clay_coupler *c, char *a, char *b, int len);
+
+/* a += gamma*b: turns x's uncoupled sub-chunk into its coupled one given
+   y's uncoupled one in b, and back again */
+
+extern void clay_coupler_add(const clay_coupler *c, char *a, char *b, int len);
+
+/* Decoder for the w=8 base code of one layer, built once per erasure
+   pattern and applied to every layer.  erased[] has k+m entries (1 for an
+   erased node).  clay_layer_decoder_new() returns NULL when the pattern is
+   not decodable.  A decoder is not modified by clay_layer_decode(), so
+   threads decoding different layers may share one. */
+
+typedef struct {
+  int k, m;
+  int ndata;                          /* erased data nodes */
+  int ncoding;                        /* erased coding nodes */
+  int *ids;                           /* erased data ids, then erased coding ids */
+  int *src_ids;                       /* k surviving nodes the data rows read */
+  galois_w08_tables *data_tables;     /* ndata x k decoding rows */
+  galois_w08_tables *coding_tables;   /* ncoding x k coding rows */
+} clay_layer_decoder;
+
+extern clay_layer_decoder *clay_layer_decoder_new(int k, int m, int *matrix, int *erased);
+extern int clay_layer_decode(const clay_layer_decoder *d, char **data, char **coding, int size);
+extern void clay_layer_decoder_free(clay_layer_decoder *d);
+
+/* Layer decoders for one code (k, m, matrix; k+m <= 64) by erasure
+   pattern, so a pattern's matrix is inverted once for all the stripes
+   and objects that share it.  clay_decoder_cache_get() returns the
+   decoder for erased[], building it on a miss, or NULL if the pattern is
+   not decodable; the caller holds it until clay_decoder_cache_put().  At
+   most capacity decoders are kept (0 for CLAY_DECODER_CACHE_DEFAULT), the
+   least recently used going first, except those still held.  Threads may
+   share a cache.
+
+   clay_decoder_cache_fill() builds the decoders for every pattern of 1 to
+   maxerased erasures up front, as far as the capacity goes, e.g. the 1470
+   patterns of up to 4 of 14 nodes.  Returns the number built, or -1. */
+
+#define CLAY_DECODER_CACHE_DEFAULT 2048
+
+typedef struct clay_decoder_cache clay_decoder_cache;
+
+extern clay_decoder_cache *clay_decoder_cache_new(int k, int m, int *matrix, int capacity);
+extern const clay_layer_decoder *clay_decoder_cache_get(clay_decoder_cache *c, int *erased);
+extern void clay_decoder_cache_put(clay_decoder_cache *c, const clay_layer_decoder *d);
+extern int clay_decoder_cache_fill(clay_decoder_cache *c, int maxerased);
+extern void clay_decoder_cache_free(clay_decoder_cache *c);
+
+/* A coupling plan lists coupled pairs as explicit work items: sub-chunk
+   a of node a at layer za with node b at layer zb, coupled with the
+   coupler's gamma.  Items are sorted by za, the lower of the two layers.
+   A plan is built once per code (or per repair) and reused for every
+   stripe. */
+
+typedef struct {
+  int a, za;
+  int b, zb;
+} clay_pair;
+
+typedef struct {
+  int npairs;
+  clay_pair *pairs;
+} clay_plan;
+
+/* Layout of an (n, k, d) Clay code: q = d-k+1 nodes per row, t = n/q
+   rows and alpha = q^t layers per node, with data nodes 0..k-1 first and
+   parity nodes after them.  Sub-chunks are found through layer views:
+   layer z of data node i at fdata[z] + i*stride and of parity node k+j at
+   fcoding[z] + j*stride.  stride is 0 for blocksize, i.e. each layer's
+   sub-chunks side by side; with node-major buffers, where each node's
+   layers follow each other as in its file, fdata[z] points at layer z
+   of node 0 and stride is alpha*blocksize.  n must be a multiple of q; the
+   coordinate tables are built once by clay_code_new(), which returns NULL
+   for parameters it cannot lay out.  The default code of the tools is
+   (k+m, k, k+1), i.e. q = 2. */
+
+#define CLAY_MAX_ALPHA (1 << 16)
+
+typedef struct {
+  int n, k, m, d;
+  int q, t, alpha;
+  int *x;                             /* node i is (x[i], y[i]) */
+  int *y;
+  int *pow;                           /* q^y, t+1 entries */
+  int *digit;                         /* digit y of layer z at z*t + y */
+  clay_plan *plan;                    /* every pair of all alpha layers */
+  long stride;                        /* between nodes in a layer view, 0: blocksize */
+} clay_code;
+
+extern clay_code *clay_code_new(int n, int k, int d);
+extern void clay_code_free(clay_code *c);
+extern char *clay_code_subchunk(const clay_code *c, char **fdata, char **fcoding,
+                                int node, int z, int blocksize);
+
+/* Returns the node that (node, z) is coupled with and sets *pz to its
+   layer, or returns -1 when the sub-chunk is uncoupled. */
+
+extern int clay_code_partner(const clay_code *c, int node, int z, int *pz);
+
+/* Couple or decouple the pairs of a plan in place; clay_code_couple()
+   and clay_code_decouple() run c->plan. */
+
+extern void clay_plan_couple(const clay_plan *p, const clay_code *c, const clay_coupler *cp,
+                             char **fdata, char **fcoding, int blocksize);
+extern void clay_plan_decouple(const clay_plan *p, const clay_code *c, const clay_coupler *cp,
+                               char **fdata, char **fcoding, int blocksize);
+
+/* The same on bytes [off, off+len) of every sub-chunk only, for encoding
+   in column tiles; with a packet coupler off and len must be multiples of
+   w*packetsize. */
+
+extern void clay_plan_couple_tile(const clay_plan *p, const clay_code *c, const clay_coupler *cp,
+                                  char **fdata, char **fcoding, int blocksize, int off, int len);
+
+extern void clay_plan_free(clay_plan *p);
+
+/* Dependency tracking for coupling while layers are still being encoded:
+   a pair can be coupled as soon as both of its layers are final, with no
+   barrier between the base-code encode and the coupling.  After
+   clay_deps_reset(), call clay_deps_layer_done() once for every layer
+   when it is final, from any thread; it couples, on the calling thread,
+   each pair whose other layer was already done.  Each pair is coupled
+   exactly once, by the call for whichever of its layers finished last; no
+   locks are taken. */
+
+typedef struct {
+  const clay_plan *plan;
+  int nlayers;
+  int *first;                         /* layer z's pairs: pairs[first[z] .. first[z+1]) */
+  int *pairs;
+  int *pending;                       /* per pair: layers not yet done */
+} clay_deps;
+
+extern clay_deps *clay_deps_new(const clay_plan *p, int nlayers);
+extern void clay_deps_reset(clay_deps *d);
+extern void clay_deps_layer_done(clay_deps *d, int z, const clay_code *c, const clay_coupler *cp,
+                                 char **fdata, char **fcoding, int blocksize);
+extern void clay_deps_free(clay_deps *d);
+extern void clay_code_couple(const clay_code *c, const clay_coupler *cp, char **fdata,
+                             char **fcoding, int blocksize);
+extern void clay_code_decouple(const clay_code *c, const clay_coupler *cp, char **fdata,
+                               char **fcoding, int blocksize);
+
+/* The pairs with a data node in them.  With no node missing, decoupling
+   them is all it takes to get the data back from the coupled layout; the
+   parity nodes they need are the ones in the rows of data nodes. */
+
+extern clay_plan *clay_code_data_plan(const clay_code *c);
+
+/* Decoding up to m erased nodes.  A layer's intersection score is the
+   number of erased nodes uncoupled in it, and layers are decoded in
+   increasing score.  Before a layer's base-code decode, the survivors'
+   uncoupled sub-chunks are made in place: pairs of two survivors are
+   decoupled, and a survivor whose partner is erased gets its uncoupled
+   sub-chunk from the partner's, which a layer of lower score has already
+   decoded.  decode_layer(arg, z, off, len) must then fill in the erased
+   nodes' uncoupled sub-chunks of layer z from the survivors'.  The
+   remaining steps leave the sub-chunks of the wanted nodes coupled and
+   all others uncoupled, touching each pair at most twice.  Only bytes
+   [off, off+len) of each sub-chunk are touched.
+
+   clay_code_decode_plan() works out the layer order and the steps for one
+   erasure pattern (erased[] has n entries) and set of wanted nodes (want[]
+   has n entries, NULL for all); it returns NULL for more than m erasures.
+   A file in the coupled layout is decoded with nothing wanted, which
+   leaves the data nodes' uncoupled sub-chunks, i.e. the input.  Encoding
+   systematically is decoding with the parity nodes erased, so that the
+   data nodes hold the input as it is. */
+
+typedef void (*clay_layer_fn)(void *arg, int z, int off, int len);
+
+typedef struct {
+  int nscores;
+  int *layers;                        /* by increasing score */
+  int *first;                         /* score s: layers[first[s] .. first[s+1]) */
+  clay_plan *steps;                   /* one pair per step, op in ops[] */
+  int *ops;
+  int *start;                         /* score s: steps start[2s] .. start[2s+1] before its
+                                         layers, .. start[2s+2] after; then the last ones */
+} clay_decode_plan;
+
+extern clay_decode_plan *clay_code_decode_plan(const clay_code *c, const int *erased,
+                                               const int *want);
+extern void clay_code_decode(const clay_decode_plan *p, const clay_code *c, const clay_coupler *cp,
+                             char **fdata, char **fcoding, int blocksize, int off, int len,
+                             clay_layer_fn decode_layer, void *arg);
+extern void clay_decode_plan_free(clay_decode_plan *p);
+
+/* Single-node repair from d helpers.  clay_code_helpers() sets helper[i]
+   for the n-entry helper set of node lost (-1 when q does not divide k).
+   The alpha/q repair layers are clay_code_repair_layer(c, lost, 0..alpha/q-1).
+   After decoupling with the plan from clay_code_repair_plan(), decode each repair layer with the
+   lost node's row and the non-helpers erased, writing the lost node into
+   its own sub-chunk and the rest of its row into u[x], then call
+   clay_code_repair_finish() to fill in the lost node's other layers. */
+
+extern int clay_code_helpers(const clay_code *c, int lost, int *helper);
+extern int clay_code_repair_layer(const clay_code *c, int lost, int i);
+extern clay_plan *clay_code_repair_plan(const clay_code *c, int lost, const int *helper);
+extern void clay_code_repair_finish(const clay_code *c, const clay_coupler *cp, int lost, int z,
+                                    char **u, char **fdata, char **fcoding, int blocksize);
+
+#endif
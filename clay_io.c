@@ -0,0 +1,394 @@
+/* clay_io.c
+ * io_uring engine for clay_io.h, with a preadv/pwritev fallback.
+ *
+ * Every operation lives in a slot of ops[] from clay_io_read() or
+ * clay_io_writev() until clay_io_wait() returns it.
+ * With io_uring a slot has at most one submission queue entry at a time,
+ * so a ring of depth entries never overflows; the slot index is the
+ * entry's user_data.  A completion that moved fewer bytes than asked
+ * advances the slot's iovecs and goes back on the ring.  The fallback
+ * runs each slot to the end at submit time and queues it as completed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#define CLAY_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "clay_io.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct {
+  int write;
+  int fd;
+  struct iovec one;                   /* clay_io_read()'s buffer */
+  struct iovec *iov;                  /* what is left to move */
+  int iovcnt;
+  off_t off;
+  int bufidx;
+  long done;
+  void *tag;
+} clay_io_op;
+
+struct clay_io {
+  int depth;
+  clay_io_op *ops;
+  int *free_ops;                      /* stack of unused slots */
+  int nfree;
+  int *queued;                        /* slots waiting for clay_io_submit() */
+  int nqueued;
+  int *completed;                     /* fallback: ring of finished slots */
+  int chead, ccount;
+  int uring;
+  int registered;
+#ifdef CLAY_IO_URING
+  int ring_fd;
+  void *sq_ring, *cq_ring;
+  size_t sq_size, cq_size, sqes_size;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned tail;                      /* our copy of *sq_tail */
+#endif
+};
+
+/* Moves the op past res bytes; returns 1 when nothing is left */
+
+static int clay_io_advance(clay_io_op *op, long res)
+{
+  op->done += res;
+  op->off += res;
+  while (op->iovcnt > 0 && res >= (long) op->iov->iov_len) {
+    res -= op->iov->iov_len;
+    op->iov++;
+    op->iovcnt--;
+  }
+  if (op->iovcnt > 0 && res > 0) {
+    op->iov->iov_base = (char *) op->iov->iov_base + res;
+    op->iov->iov_len -= res;
+  }
+  return op->iovcnt == 0;
+}
+
+static long clay_io_run_sync(clay_io_op *op)
+{
+  ssize_t res;
+
+  while (op->iovcnt > 0) {
+    if (op->write) {
+      res = pwritev(op->fd, op->iov, (op->iovcnt < IOV_MAX) ? op->iovcnt : IOV_MAX, op->off);
+    } else {
+      res = preadv(op->fd, op->iov, (op->iovcnt < IOV_MAX) ? op->iovcnt : IOV_MAX, op->off);
+    }
+    if (res < 0 && errno == EINTR) continue;
+    if (res < 0) return -errno;
+    if (res == 0) {
+      if (op->write) return -EIO;
+      break;
+    }
+    clay_io_advance(op, res);
+  }
+  return op->done;
+}
+
+#ifdef CLAY_IO_URING
+
+static int clay_io_uring_setup(clay_io *io)
+{
+  struct io_uring_params p;
+  char *cq;
+
+  memset(&p, 0, sizeof(p));
+  io->ring_fd = syscall(__NR_io_uring_setup, io->depth, &p);
+  if (io->ring_fd < 0) return -1;
+
+  io->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  io->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  io->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  io->sq_ring = mmap(NULL, io->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     io->ring_fd, IORING_OFF_SQ_RING);
+  io->cq_ring = mmap(NULL, io->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     io->ring_fd, IORING_OFF_CQ_RING);
+  io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  io->ring_fd, IORING_OFF_SQES);
+  if (io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED || io->sqes == MAP_FAILED) {
+    if (io->sq_ring != MAP_FAILED) munmap(io->sq_ring, io->sq_size);
+    if (io->cq_ring != MAP_FAILED) munmap(io->cq_ring, io->cq_size);
+    if (io->sqes != MAP_FAILED) munmap(io->sqes, io->sqes_size);
+    close(io->ring_fd);
+    return -1;
+  }
+  io->sq_tail = (unsigned *) ((char *) io->sq_ring + p.sq_off.tail);
+  io->sq_mask = (unsigned *) ((char *) io->sq_ring + p.sq_off.ring_mask);
+  io->sq_array = (unsigned *) ((char *) io->sq_ring + p.sq_off.array);
+  cq = (char *) io->cq_ring;
+  io->cq_head = (unsigned *) (cq + p.cq_off.head);
+  io->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  io->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  io->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  io->tail = *io->sq_tail;
+  return 0;
+}
+
+/* Puts slot i's next piece on the submission ring */
+
+static void clay_io_uring_prep(clay_io *io, int i)
+{
+  clay_io_op *op;
+  struct io_uring_sqe *sqe;
+  unsigned idx;
+
+  op = &io->ops[i];
+  idx = io->tail & *io->sq_mask;
+  sqe = &io->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = op->fd;
+  sqe->off = op->off;
+  sqe->user_data = i;
+  if (op->write) {
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->addr = (unsigned long) op->iov;
+    sqe->len = (op->iovcnt < IOV_MAX) ? op->iovcnt : IOV_MAX;
+  } else if (op->bufidx >= 0 && io->registered) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = (unsigned long) op->iov->iov_base;
+    sqe->len = (op->iov->iov_len < (1U << 30)) ? op->iov->iov_len : (1U << 30);
+    sqe->buf_index = op->bufidx;
+  } else {
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = (unsigned long) op->iov;
+    sqe->len = (op->iovcnt < IOV_MAX) ? op->iovcnt : IOV_MAX;
+  }
+  io->sq_array[idx] = idx;
+  io->tail++;
+}
+
+static int clay_io_uring_enter(clay_io *io, unsigned submit, unsigned wait)
+{
+  int res;
+
+  do {
+    res = syscall(__NR_io_uring_enter, io->ring_fd, submit, wait,
+                  wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (res < 0 && errno == EINTR);
+  return res;
+}
+
+#endif
+
+clay_io *clay_io_new(int depth)
+{
+  clay_io *io;
+  int i;
+
+  if (depth < 1) return NULL;
+  io = (clay_io *) calloc(1, sizeof(clay_io));
+  if (io == NULL) return NULL;
+  io->depth = depth;
+  io->ops = (clay_io_op *) malloc(sizeof(clay_io_op) * depth);
+  io->free_ops = (int *) malloc(sizeof(int) * depth);
+  io->queued = (int *) malloc(sizeof(int) * depth);
+  io->completed = (int *) malloc(sizeof(int) * depth);
+  if (io->ops == NULL || io->free_ops == NULL || io->queued == NULL || io->completed == NULL) {
+    clay_io_free(io);
+    return NULL;
+  }
+  for (i = 0; i < depth; i++) io->free_ops[i] = depth - 1 - i;
+  io->nfree = depth;
+
+#ifdef CLAY_IO_URING
+  if (getenv("CLAY_IO") == NULL || strcmp(getenv("CLAY_IO"), "sync") != 0) {
+    io->uring = (clay_io_uring_setup(io) == 0);
+  }
+#endif
+  return io;
+}
+
+const char *clay_io_engine(const clay_io *io)
+{
+  return io->uring ? "io_uring" : "preadv/pwritev";
+}
+
+int clay_io_register(clay_io *io, const struct iovec *bufs, int n)
+{
+#ifdef CLAY_IO_URING
+  /* Pinned pages count against RLIMIT_MEMLOCK; without them reads just
+     go through READV */
+  if (io->uring && !io->registered &&
+      syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_BUFFERS, bufs, n) == 0) {
+    io->registered = 1;
+  }
+#else
+  (void) bufs;
+  (void) n;
+#endif
+  return io->registered;
+}
+
+static int clay_io_queue(clay_io *io, clay_io_op *src)
+{
+  int i;
+
+  if (io->nfree == 0) return -1;
+  i = io->free_ops[--io->nfree];
+  io->ops[i] = *src;
+  if (io->ops[i].iov == NULL) io->ops[i].iov = &io->ops[i].one;
+  io->queued[io->nqueued++] = i;
+#ifdef CLAY_IO_URING
+  if (io->uring) clay_io_uring_prep(io, i);
+#endif
+  return 0;
+}
+
+int clay_io_read(clay_io *io, int fd, void *buf, long len, off_t off, int bufidx, void *tag)
+{
+  clay_io_op op;
+
+  memset(&op, 0, sizeof(op));
+  op.fd = fd;
+  op.one.iov_base = buf;
+  op.one.iov_len = len;
+  op.iovcnt = (len > 0);
+  op.off = off;
+  op.bufidx = bufidx;
+  op.tag = tag;
+  return clay_io_queue(io, &op);
+}
+
+int clay_io_writev(clay_io *io, int fd, struct iovec *iov, int iovcnt, off_t off, void *tag)
+{
+  clay_io_op op;
+
+  memset(&op, 0, sizeof(op));
+  op.write = 1;
+  op.fd = fd;
+  op.iov = iov;
+  op.iovcnt = iovcnt;
+  op.off = off;
+  op.bufidx = -1;
+  op.tag = tag;
+  return clay_io_queue(io, &op);
+}
+
+int clay_io_submit(clay_io *io)
+{
+  int i, res;
+
+#ifdef CLAY_IO_URING
+  if (io->uring) {
+    __atomic_store_n(io->sq_tail, io->tail, __ATOMIC_RELEASE);
+    while (io->nqueued > 0) {
+      res = clay_io_uring_enter(io, io->nqueued, 0);
+      if (res < 0) return -1;
+      io->nqueued -= res;
+    }
+    return 0;
+  }
+#endif
+  for (i = 0; i < io->nqueued; i++) {
+    res = clay_io_run_sync(&io->ops[io->queued[i]]);
+    if (res < 0) io->ops[io->queued[i]].done = res;
+    io->completed[(io->chead + io->ccount++) % io->depth] = io->queued[i];
+  }
+  io->nqueued = 0;
+  return 0;
+}
+
+static void clay_io_finish(clay_io *io, int i, void **tag, long *res)
+{
+  *tag = io->ops[i].tag;
+  *res = io->ops[i].done;
+  io->free_ops[io->nfree++] = i;
+}
+
+int clay_io_wait(clay_io *io, void **tag, long *res)
+{
+  int i;
+#ifdef CLAY_IO_URING
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  clay_io_op *op;
+  int got;
+#endif
+
+  if (io->nfree == io->depth) return -1;
+  if (io->nqueued > 0 && clay_io_submit(io) < 0) return -1;
+
+#ifdef CLAY_IO_URING
+  if (io->uring) {
+    for (;;) {
+      head = *io->cq_head;
+      if (head == __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (clay_io_uring_enter(io, 0, 1) < 0) return -1;
+        continue;
+      }
+      cqe = &io->cqes[head & *io->cq_mask];
+      i = (int) cqe->user_data;
+      got = cqe->res;
+      __atomic_store_n(io->cq_head, head + 1, __ATOMIC_RELEASE);
+
+      op = &io->ops[i];
+      if (got == -EINTR || got == -EAGAIN) {
+        /* resubmitted as is */
+      } else if (got < 0) {
+        op->done = got;
+        break;
+      } else if (got == 0) {
+        if (op->write) op->done = -EIO;
+        break;
+      } else if (clay_io_advance(op, got)) {
+        break;
+      }
+      clay_io_uring_prep(io, i);
+      io->nqueued++;
+      if (clay_io_submit(io) < 0) return -1;
+    }
+    clay_io_finish(io, i, tag, res);
+    return 0;
+  }
+#endif
+  i = io->completed[io->chead];
+  io->chead = (io->chead + 1) % io->depth;
+  io->ccount--;
+  clay_io_finish(io, i, tag, res);
+  return 0;
+}
+
+int clay_io_outstanding(const clay_io *io)
+{
+  return io->depth - io->nfree;
+}
+
+void clay_io_free(clay_io *io)
+{
+  if (io == NULL) return;
+#ifdef CLAY_IO_URING
+  if (io->uring) {
+    munmap(io->sqes, io->sqes_size);
+    munmap(io->cq_ring, io->cq_size);
+    munmap(io->sq_ring, io->sq_size);
+    close(io->ring_fd);
+  }
+#endif
+  free(io->ops);
+  free(io->free_ops);
+  free(io->queued);
+  free(io->completed);
+  free(io);
+}
@@ -0,0 +1,53 @@
+/* clay_io.h
+ * Batched file I/O for the encoder, decoder and repair tools.
+ *
+ * Reads and gathered writes are queued with clay_io_read() and
+ * clay_io_writev(), handed to the kernel together by clay_io_submit(),
+ * and finish in any order through clay_io_wait().  Each carries a tag for
+ * the caller and completes in full: short transfers are continued by the
+ * engine, so the result is the whole length or a negative errno (a read
+ * that hits end of file returns what it got).
+ *
+ * On Linux the engine is io_uring, set up with plain system calls.
+ * Where that is missing or refused, or with CLAY_IO=sync, the same calls
+ * run as preadv/pwritev at submit time, so callers do not tell the two
+ * apart.  A clay_io belongs to one thread.
+ */
+
+#ifndef _CLAY_IO_H
+#define _CLAY_IO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef struct clay_io clay_io;
+
+/* depth bounds the operations queued or in flight at a time.  Returns
+   NULL if out of memory. */
+
+extern clay_io *clay_io_new(int depth);
+extern const char *clay_io_engine(const clay_io *io);
+
+/* Registers long-lived buffers (e.g. stripe arenas) with the kernel, so
+   reads into buffer i can pass bufidx i and skip the page pinning per
+   call.  Returns 1 if they were registered, 0 if bufidx must be -1. */
+
+extern int clay_io_register(clay_io *io, const struct iovec *bufs, int n);
+
+/* All return -1 if depth operations are already outstanding.  iov must
+   stay valid until the operation completes; the engine may change it. */
+
+extern int clay_io_read(clay_io *io, int fd, void *buf, long len, off_t off, int bufidx,
+                        void *tag);
+extern int clay_io_writev(clay_io *io, int fd, struct iovec *iov, int iovcnt, off_t off,
+                          void *tag);
+extern int clay_io_submit(clay_io *io);
+
+/* Blocks for one completed operation.  Returns 0, or -1 if none is
+   outstanding. */
+
+extern int clay_io_wait(clay_io *io, void **tag, long *res);
+extern int clay_io_outstanding(const clay_io *io);
+extern void clay_io_free(clay_io *io);
+
+#endif
@@ -0,0 +1,317 @@
+/* clay_pool.c
+ * Worker threads for clay_pool_run(), and the queues between the stages
+ * of a pipeline.
+ *
+ * Every thread owns a range of task numbers and claims tasks from its
+ * front with an atomic increment.  Once its own range is empty it moves
+ * on to the other threads' ranges the same way, so a thread slowed down by
+ * large tasks or by the scheduler has its remaining tasks taken over.
+ * A run is started by bumping the generation under the lock and ends when
+ * the last worker reports back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "clay_pool.h"
+
+/* next and end of one thread's range, a cache line to itself */
+
+typedef struct {
+  long next;
+  long end;
+  char pad[64 - 2 * sizeof(long)];
+} clay_pool_range;
+
+typedef struct {
+  clay_pool *pool;
+  int self;
+} clay_pool_worker;
+
+struct clay_pool {
+  int nthreads;
+  pthread_t *threads;
+  clay_pool_worker *workers;
+  clay_pool_range *ranges;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned long generation;
+  int running;                        /* workers not yet done with this run */
+  int quit;
+  clay_pool_fn fn;
+  void *arg;
+};
+
+static void clay_pool_work(clay_pool *p, int self)
+{
+  clay_pool_range *r;
+  long task;
+  int i;
+
+  for (i = 0; i < p->nthreads; i++) {
+    r = &p->ranges[(self + i) % p->nthreads];
+    while ((task = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED)) < r->end) {
+      p->fn(p->arg, (int) task);
+    }
+  }
+}
+
+static void *clay_pool_thread(void *a)
+{
+  clay_pool_worker *wk;
+  clay_pool *p;
+  unsigned long seen;
+
+  wk = (clay_pool_worker *) a;
+  p = wk->pool;
+  seen = 0;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (!p->quit && p->generation == seen) pthread_cond_wait(&p->start, &p->lock);
+    if (p->quit) break;
+    seen = p->generation;
+    pthread_mutex_unlock(&p->lock);
+
+    clay_pool_work(p, wk->self);
+
+    pthread_mutex_lock(&p->lock);
+    if (--p->running == 0) pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+clay_pool *clay_pool_new(int nthreads)
+{
+  clay_pool *p;
+  int i;
+
+  if (nthreads < 1) return NULL;
+  p = (clay_pool *) calloc(1, sizeof(clay_pool));
+  if (p == NULL) return NULL;
+  p->nthreads = nthreads;
+  if (nthreads == 1) return p;
+
+  p->threads = (pthread_t *) malloc(sizeof(pthread_t) * nthreads);
+  p->workers = (clay_pool_worker *) malloc(sizeof(clay_pool_worker) * nthreads);
+  if (posix_memalign((void **) &p->ranges, 64, sizeof(clay_pool_range) * nthreads) != 0) {
+    p->ranges = NULL;
+  }
+  if (p->threads == NULL || p->workers == NULL || p->ranges == NULL) {
+    free(p->threads);
+    free(p->workers);
+    free(p->ranges);
+    free(p);
+    return NULL;
+  }
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start, NULL);
+  pthread_cond_init(&p->done, NULL);
+
+  /* worker 0 is the caller */
+  for (i = 1; i < nthreads; i++) {
+    p->workers[i].pool = p;
+    p->workers[i].self = i;
+    if (pthread_create(&p->threads[i], NULL, clay_pool_thread, &p->workers[i]) != 0) {
+      p->nthreads = i;
+      clay_pool_free(p);
+      return NULL;
+    }
+  }
+  return p;
+}
+
+int clay_pool_threads(const clay_pool *p)
+{
+  return p->nthreads;
+}
+
+void clay_pool_run(clay_pool *p, int ntasks, clay_pool_fn fn, void *arg)
+{
+  int i;
+
+  if (ntasks <= 0) return;
+  if (p->nthreads == 1) {
+    for (i = 0; i < ntasks; i++) fn(arg, i);
+    return;
+  }
+
+  for (i = 0; i < p->nthreads; i++) {
+    p->ranges[i].next = (long) ntasks * i / p->nthreads;
+    p->ranges[i].end = (long) ntasks * (i + 1) / p->nthreads;
+  }
+  pthread_mutex_lock(&p->lock);
+  p->fn = fn;
+  p->arg = arg;
+  p->running = p->nthreads - 1;
+  p->generation++;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  clay_pool_work(p, 0);
+
+  pthread_mutex_lock(&p->lock);
+  while (p->running > 0) pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+}
+
+void clay_pool_free(clay_pool *p)
+{
+  int i;
+
+  if (p == NULL) return;
+  if (p->nthreads > 1) {
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 1; i < p->nthreads; i++) pthread_join(p->threads[i], NULL);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->start);
+    pthread_cond_destroy(&p->done);
+  }
+  free(p->threads);
+  free(p->workers);
+  free(p->ranges);
+  free(p);
+}
+
+/* clay_queue: Vyukov's bounded queue.  Slot i of the ring is free for
+   the push at position pos when its seq is pos, and holds the item for
+   the pop at pos when its seq is pos+1; the pop hands it back for pos +
+   capacity. */
+
+typedef struct {
+  unsigned long seq;
+  void *item;
+} clay_queue_cell;
+
+struct clay_queue {
+  int capacity;
+  clay_queue_cell *cells;
+  unsigned long tail;                 /* next push */
+  char pad1[64];
+  unsigned long head;                 /* next pop */
+  char pad2[64];
+  int sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+};
+
+clay_queue *clay_queue_new(int capacity)
+{
+  clay_queue *q;
+  int i;
+
+  if (capacity < 1) return NULL;
+  q = (clay_queue *) calloc(1, sizeof(clay_queue));
+  if (q == NULL) return NULL;
+  q->cells = (clay_queue_cell *) malloc(sizeof(clay_queue_cell) * capacity);
+  if (q->cells == NULL) {
+    free(q);
+    return NULL;
+  }
+  q->capacity = capacity;
+  for (i = 0; i < capacity; i++) q->cells[i].seq = i;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->wake, NULL);
+  return q;
+}
+
+/* The cell for position pos of counter *at is ready when its seq is pos +
+   ready; claims the position if so */
+
+static clay_queue_cell *clay_queue_claim(clay_queue *q, unsigned long *at, unsigned long ready)
+{
+  clay_queue_cell *cell;
+  unsigned long pos;
+  long dif;
+
+  pos = __atomic_load_n(at, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &q->cells[pos % q->capacity];
+    dif = (long) (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + ready));
+    if (dif < 0) return NULL;
+    if (dif == 0 && __atomic_compare_exchange_n(at, &pos, pos + 1, 0, __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED)) {
+      return cell;
+    }
+    if (dif > 0) pos = __atomic_load_n(at, __ATOMIC_RELAXED);
+  }
+}
+
+/* Sleeps until the cell at *at may be ready.  The sleeper count goes up
+   before the cell is looked at again, and the other side publishes the
+   cell before it looks at the count, so one of the two sees the other. */
+
+static void clay_queue_wait(clay_queue *q, unsigned long *at, unsigned long ready)
+{
+  unsigned long pos;
+
+  pthread_mutex_lock(&q->lock);
+  __atomic_add_fetch(&q->sleepers, 1, __ATOMIC_SEQ_CST);
+  pos = __atomic_load_n(at, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&q->cells[pos % q->capacity].seq, __ATOMIC_SEQ_CST) != pos + ready) {
+    pthread_cond_wait(&q->wake, &q->lock);
+  }
+  __atomic_sub_fetch(&q->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static void clay_queue_publish(clay_queue *q, clay_queue_cell *cell, unsigned long seq)
+{
+  __atomic_store_n(&cell->seq, seq, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&q->sleepers, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+  }
+}
+
+void clay_queue_push(clay_queue *q, void *item)
+{
+  clay_queue_cell *cell;
+  unsigned long pos;
+
+  while ((cell = clay_queue_claim(q, &q->tail, 0)) == NULL) clay_queue_wait(q, &q->tail, 0);
+  pos = cell->seq;
+  cell->item = item;
+  clay_queue_publish(q, cell, pos + 1);
+}
+
+void *clay_queue_pop(clay_queue *q)
+{
+  clay_queue_cell *cell;
+  unsigned long pos;
+  void *item;
+
+  while ((cell = clay_queue_claim(q, &q->head, 1)) == NULL) clay_queue_wait(q, &q->head, 1);
+  pos = cell->seq - 1;
+  item = cell->item;
+  clay_queue_publish(q, cell, pos + q->capacity);
+  return item;
+}
+
+int clay_queue_trypop(clay_queue *q, void **item)
+{
+  clay_queue_cell *cell;
+  unsigned long pos;
+
+  cell = clay_queue_claim(q, &q->head, 1);
+  if (cell == NULL) return 0;
+  pos = cell->seq - 1;
+  *item = cell->item;
+  clay_queue_publish(q, cell, pos + q->capacity);
+  return 1;
+}
+
+void clay_queue_free(clay_queue *q)
+{
+  if (q == NULL) return;
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->wake);
+  free(q->cells);
+  free(q);
+}
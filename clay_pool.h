@@ -0,0 +1,48 @@
+/* clay_pool.h
+ * A fixed pool of worker threads for the independent pieces of an
+ * encode: base-code layers or column tiles.
+ *
+ * clay_pool_run() calls fn(arg, i) once for every i in [0, ntasks) and
+ * returns when all calls have finished, so consecutive runs are ordered
+ * phases.  The calling thread takes part.  Tasks are dealt out as one
+ * contiguous range per thread; a thread that finishes its range steals
+ * tasks from the others' ranges.
+ *
+ * clay_queue links threads that hand work on to each other, e.g. the
+ * reader, encoder and writers of the encode pipeline.
+ */
+
+#ifndef _CLAY_POOL_H
+#define _CLAY_POOL_H
+
+typedef void (*clay_pool_fn)(void *arg, int task);
+
+typedef struct clay_pool clay_pool;
+
+/* nthreads counts the caller; with 1 no threads are started and tasks run
+   in order.  Returns NULL if the threads cannot be started. */
+
+extern clay_pool *clay_pool_new(int nthreads);
+extern int clay_pool_threads(const clay_pool *p);
+extern void clay_pool_run(clay_pool *p, int ntasks, clay_pool_fn fn, void *arg);
+extern void clay_pool_free(clay_pool *p);
+
+/* A bounded FIFO of pointers between pipeline stages, any number of
+   producers and consumers.  Items move through per-slot sequence numbers
+   without a lock; a side that finds the queue full (push) or empty (pop)
+   sleeps until the other side makes room or adds an item.  NULL can be
+   queued, e.g. as an end marker.  clay_queue_new() returns NULL if out of
+   memory. */
+
+typedef struct clay_queue clay_queue;
+
+extern clay_queue *clay_queue_new(int capacity);
+extern void clay_queue_push(clay_queue *q, void *item);
+extern void *clay_queue_pop(clay_queue *q);
+
+/* Pops without sleeping: returns 1 and sets *item, or 0 if empty */
+
+extern int clay_queue_trypop(clay_queue *q, void **item);
+extern void clay_queue_free(clay_queue *q);
+
+#endif
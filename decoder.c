@@ -66,6 +66,7 @@ same arguments, and encoder.c does error check.
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include "jerasure.h"
@@ -74,9 +75,10 @@ same arguments, and encoder.c does error check.
 #include "cauchy.h"
 #include "liberation.h"
 #include "timing.h"
+#include "clay.h"
+#include "clay_io.h"
 
 #define N 10
-#define M 128
 #define r 2
 enum Coding_Technique {Reed_Sol_Van, Reed_Sol_R6_Op, Cauchy_Orig, Cauchy_Good, Liberation, Blaum_Roth, Liber8tion, RDP, EVENODD, No_Coding};
 
@@ -89,6 +91,116 @@ int readins, n;
 /* Function prototype */
 void ctrl_bs_handler(int dummy);
 
+/* What the base-code decode of a layer needs */
+struct layer_job {
+	int tech, k, m, w, packetsize;
+	int *matrix;
+	int *bitmatrix;
+	int *erasures;
+	const clay_layer_decoder *layer_decoder;
+	char **fdata;
+	char **fcoding;
+	int blocksize;
+	long stride;			// between a layer's sub-chunks of two nodes
+};
+
+/* Decodes bytes [off, off+len) of the erased sub-chunks of layer z */
+static void decode_layer(void *arg, int z, int off, int len)
+{
+	struct layer_job *job = arg;
+	char *data[job->k];
+	char *coding[job->m];
+	int i, ret;
+
+	for (i = 0; i < job->k; i++) {
+		data[i] = job->fdata[z] + i*job->stride + off;
+	}
+	for (i = 0; i < job->m; i++) {
+		coding[i] = job->fcoding[z] + i*job->stride + off;
+	}
+	/* Choose proper decoding method */
+	ret = 0;
+	if (job->layer_decoder != NULL) {
+		ret = clay_layer_decode(job->layer_decoder, data, coding, len);
+	}
+	else if (job->tech == Reed_Sol_Van || job->tech == Reed_Sol_R6_Op) {
+		ret = jerasure_matrix_decode(job->k, job->m, job->w, job->matrix, 0, job->erasures,
+			data, coding, len);
+	}
+	else if (job->tech == Cauchy_Orig || job->tech == Cauchy_Good) {
+		ret = jerasure_schedule_decode_lazy(job->k, job->m, job->w, job->bitmatrix, job->erasures,
+			data, coding, len, job->packetsize, 1);
+	}
+	if (ret == -1) {
+		fprintf(stderr, "Unsuccessful!\n");
+		exit(0);
+	}
+}
+
+/* The file of node i: _k for data, _m for parity nodes */
+static void node_file(char *fname, const char *curdir, const char *cs1, int md, int k, int i,
+	const char *extension)
+{
+	if (i < k) {
+		sprintf(fname, "%s/Coding/%s_k%0*d%s", curdir, cs1, md, i, extension);
+	}
+	else {
+		sprintf(fname, "%s/Coding/%s_m%0*d%s", curdir, cs1, md, i-k, extension);
+	}
+}
+
+/* Waits for completions up to the operation tagged until, or with until
+   NULL for all outstanding ones.  Tags are the names of the files; reads
+   must return len bytes and writes no error.  Exits naming the file on
+   any failure. */
+static void wait_io(clay_io *io, const char *until, long len)
+{
+	void *tag;
+	long res;
+
+	while (clay_io_outstanding(io) > 0) {
+		if (clay_io_wait(io, &tag, &res) < 0) {
+			fprintf(stderr, "Node file I/O failed.\n");
+			exit(0);
+		}
+		if (until != NULL && tag == until) {
+			if (res < 0) {
+				fprintf(stderr, "Unable to write %s.\n", until);
+				exit(0);
+			}
+			return;
+		}
+		if (res != len) {
+			fprintf(stderr, "Unable to read %s.\n", (const char *)tag);
+			exit(0);
+		}
+	}
+}
+
+/* Queues readin n of every open node file into the node-major buffers
+   viewed by fdata and fcoding, and submits it */
+static void read_readin(clay_io *io, const clay_code *code, int *node_fd, char **node_name,
+	char **fdata, char **fcoding, int blocksize, int n)
+{
+	int i;
+
+	for (i = 0; i < code->n; i++) {
+		if (node_fd[i] < 0) {
+			continue;
+		}
+		if (clay_io_read(io, node_fd[i], clay_code_subchunk(code, fdata, fcoding, i, 0, blocksize),
+		                 (long)code->alpha*blocksize, (off_t)(n-1)*code->alpha*blocksize, -1,
+		                 node_name[i]) < 0) {
+			fprintf(stderr, "Unable to read %s.\n", node_name[i]);
+			exit(0);
+		}
+	}
+	if (clay_io_submit(io) < 0) {
+		fprintf(stderr, "Unable to submit the reads of readin %d.\n", n);
+		exit(0);
+	}
+}
+
 int main (int argc, char **argv) {
 	FILE *fp;				// File pointer
 
@@ -99,21 +211,43 @@ int main (int argc, char **argv) {
 	int *erased;
 	int *matrix;
 	int *bitmatrix;
+	clay_coupler *coupler;		// pairwise coupling transform
+	clay_code *code;		// node/layer layout
+	int alpha;			// layers per node
+	int z;
 	char **fdata;
 	char **fcoding;
-	char **tempcoding;
-	char **tempdata;
+	char *databuf[2];		// data nodes, node-major, per readin in flight
+	char *codingbuf[2];		// parity nodes, node-major
+	char **fdata_set[2];		// layer views of databuf[]
+	char **fcoding_set[2];
+	int nbufs, cur;
 	/* Parameters */
-	int k, m, w, packetsize, buffersize;
+	int k, m, w, packetsize;
+	long long buffersize;		// input bytes per readin
+	int d;
+	int systematic;			// data files hold the input as it is
+	clay_decode_plan *decode_plan;	// erasure decoding, either layout
+	int *want;			// nodes to leave coupled by it
+	int healthy;			// no node missing
+	clay_plan *data_plan;		// pairs to decouple when healthy
+	clay_decoder_cache *decoder_cache;	// w=8 decoding rows by erasure pattern
+	struct layer_job lj;
 	int tech;
 	char *c_tech;
 	int jj=0;
 	int i, j,i1,j1;				// loop control variable, s
 	int blocksize = 0;			// size of individual files
-	int origsize;			// size of file before padding
-	int total;				// used to write data, not padding to file
+	long long origsize;		// size of file before padding
+	long long total;				// used to write data, not padding to file
 	struct stat status;		// used to find size of individual files
 	int numerased;			// number of erased files
+	clay_io *io;			// batched node file I/O
+	int *node_fd;
+	char **node_name;		// node file names, the tags of their reads
+	struct iovec *out_iov;		// one per data sub-chunk
+	int out_fd;			// opened with the first readin
+	off_t out_pos;			// where this readin's part goes
 		
 	/* Used to recreate file names */
 	char *temp;
@@ -136,6 +270,7 @@ int main (int argc, char **argv) {
 
 	matrix = NULL;
 	bitmatrix = NULL;
+	coupler = NULL;
 	totalsec = 0.0;
 	
 	/* Start timing */
@@ -182,11 +317,11 @@ int main (int argc, char **argv) {
 		exit(0);
 	}
 	
-	if (fscanf(fp, "%d", &origsize) != 1) {
+	if (fscanf(fp, "%lld", &origsize) != 1) {
 		fprintf(stderr, "Original size is not valid\n");
 		exit(0);
 	}
-	if (fscanf(fp, "%d %d %d %d %d", &k, &m, &w, &packetsize, &buffersize) != 5) {
+	if (fscanf(fp, "%d %d %d %d %lld", &k, &m, &w, &packetsize, &buffersize) != 5) {
 		fprintf(stderr, "Parameters are not correct\n");
 		exit(0);
 	}
@@ -204,35 +339,44 @@ int main (int argc, char **argv) {
 		fprintf(stderr, "Metadata file - bad format\n");
 		exit(0);
 	}
+	/* Files encoded before d was recorded use the q = 2 layout */
+	if (fscanf(fp, "%d", &d) != 1) {
+		d = k + 1;
+	}
+	/* and before --systematic, the coupled layout */
+	if (fscanf(fp, "%d", &systematic) != 1) {
+		systematic = 0;
+	}
 	fclose(fp);	
 
+	code = clay_code_new(k + m, k, d);
+	if (code == NULL) {
+		fprintf(stderr, "No Clay layout for n=%d k=%d d=%d\n", k + m, k, d);
+		exit(0);
+	}
+	alpha = code->alpha;
+
 	/* Allocate memory */
 	erased = (int *)malloc(sizeof(int)*(k+m));
 	for (i = 0; i < k+m; i++)
 		erased[i] = 0;
 	erasures = (int *)malloc(sizeof(int)*(k+m));
+	node_fd = (int *)malloc(sizeof(int)*(k+m));
+	node_name = (char **)malloc(sizeof(char *)*(k+m));
+	out_iov = (struct iovec *)malloc(sizeof(struct iovec)*alpha*k);
+	io = clay_io_new(k+m+1);
+	if (node_fd == NULL || out_iov == NULL || io == NULL) {
+		fprintf(stderr, "Unable to set up file I/O.\n");
+		exit(0);
+	}
 
 	data = (char **)malloc(sizeof(char *)*k);
 	coding = (char **)malloc(sizeof(char *)*m);
-	tempdata = (char **)malloc(sizeof(char *)*k);
-	tempcoding = (char **)malloc(sizeof(char *)*m);
 				
-	if (buffersize != origsize) {
-		for (i = 0; i < k; i++) {
-			data[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-			tempdata[i] = (char *)malloc(sizeof(char *)*(buffersize/k));
-		}
-		for (i = 0; i < m; i++) {
-			coding[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-			tempcoding[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-		}
-		blocksize = buffersize/k;
-	}
-
 	sprintf(temp, "%d", k);
 	md = strlen(temp);
 	
-        printf("buffersize:%d\n", buffersize);
+        printf("buffersize:%lld\n", buffersize);
    
 	//if (buffersize = origsize) {
 	//blocksize=224;}
@@ -268,6 +412,19 @@ int main (int argc, char **argv) {
 		case Liber8tion:
 			bitmatrix = liber8tion_coding_bitmatrix(k);
 	}
+
+	/* Same sub-chunk layout as the encoder: w-packet groups for the
+	   cauchy codes, GF(2^8) bytes otherwise */
+	if (tech == Cauchy_Orig || tech == Cauchy_Good) {
+		coupler = clay_coupler_new(r, w, packetsize);
+	}
+	else {
+		coupler = clay_coupler_new(r, 8, 0);
+	}
+	if (coupler == NULL) {
+		fprintf(stderr, "Unable to set up coupling for w=%d packetsize=%d.\n", w, packetsize);
+		exit(0);
+	}
 	timing_set(&t4);
 	totalsec += timing_delta(&t3, &t4);
 	printf("matrix: \n");
@@ -277,75 +434,115 @@ printf("\n");
 printf( " 0\n");
 
 
-	/* Begin decoding process */
-	total = 0;
-	n = 1;	
-	while (n <= readins) {
-		numerased = 0;
-		/* Open files, check for erasures, read in data/coding */	
-			
-		for (i = 0; i < k; i++) {
-			sprintf(fname, "%s/Coding/%s_k%0*d%s", curdir, cs1, md, i, extension);
-			fp = fopen(fname, "rb");
-			if (fp == NULL) {
-				erased[i] = 1;
-				erasures[numerased] = i;
-				numerased++;}
-				
-			else {
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size/M;
-					//blocksize=224;
-					//blocksize=112;
-					data[i] = (char *)malloc(sizeof(char)*blocksize);
-					tempdata[i] = (char *)malloc(sizeof(char)*M*blocksize);
-					assert(M*blocksize == fread(tempdata[i], sizeof(char), M*blocksize, fp));
-				}
-				
-				fclose(fp);
+	/* Open the node files once; a missing one is an erasure.  Readin n
+	   is the n-th run of alpha sub-chunks in every file. */
+	numerased = 0;
+	for (i = 0; i < k+m; i++) {
+		node_file(fname, curdir, cs1, md, k, i, extension);
+		node_name[i] = strdup(fname);
+		node_fd[i] = open(fname, O_RDONLY);
+		if (node_fd[i] < 0) {
+			erased[i] = 1;
+			erasures[numerased] = i;
+			numerased++;
+		}
+		else if (blocksize == 0) {
+			fstat(node_fd[i], &status);
+			blocksize = status.st_size/((long long)alpha*readins);
+		}
+	}
+	erasures[numerased] = -1;
+	/* A systematic file keeps its data nodes coupled, as they hold the
+	   input; in the coupled layout the input is the uncoupled data. */
+	decode_plan = NULL;
+	if (numerased > 0) {
+		want = (int *)malloc(sizeof(int)*(k+m));
+		for (i = 0; i < k+m; i++) {
+			want[i] = (systematic && i < k);
+		}
+		decode_plan = clay_code_decode_plan(code, erased, want);
+		free(want);
+		if (decode_plan == NULL) {
+			fprintf(stderr, "Unsuccessful!\n");
+			exit(0);
+		}
+	}
+	/* With no node missing the base code is skipped.  A systematic file holds the
+	   data as it is; otherwise only the pairs with a data node in them
+	   are decoupled, which needs the parity nodes in the data nodes'
+	   rows and no others. */
+	healthy = (numerased == 0);
+	data_plan = NULL;
+	if (healthy) {
+		if (!systematic) {
+			data_plan = clay_code_data_plan(code);
+			if (data_plan == NULL) {
+				fprintf(stderr, "Unsuccessful!\n");
+				exit(0);
 			}
 		}
-				
-					
-		for (i = 0; i < m; i++) {
-			sprintf(fname, "%s/Coding/%s_m%0*d%s", curdir, cs1, md, i, extension);
-				fp = fopen(fname, "rb");
-				if (fp == NULL) {
-				erased[k+i] = 1;
-				erasures[numerased] = k+i;
-				numerased++;}	
-			else{
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size/M;
-					//blocksize=224;
-					//blocksize=112;
-					coding[i] = (char *)malloc(sizeof(char)*blocksize);
-					tempcoding[i] = (char *)malloc(sizeof(char)*M*blocksize);
-					assert(M*blocksize == fread(tempcoding[i], sizeof(char), M*blocksize, fp));
-				}
-					
-				fclose(fp);
+		for (i = k; i < k+m; i++) {
+			if (systematic || code->y[i] != code->y[k-1]) {
+				close(node_fd[i]);
+				node_fd[i] = -1;
 			}
 		}
+	}
 printf("\n");
 printf("blocksize:%d\n", blocksize);
+	if (clay_coupler_check(coupler, blocksize) < 0) {
+		fprintf(stderr, "Sub-chunks of %d bytes are not whole w*packetsize groups.\n", blocksize);
+		exit(0);
+	}
 printf("\n");
-	/* Finish allocating data/coding if needed */
-		if (n == 1) {
-			for (i = 0; i < numerased; i++) {
-				if (erasures[i] < k) {
-					data[erasures[i]] = (char *)malloc(sizeof(char)*blocksize);
-					tempdata[erasures[i]] = (char *)malloc(sizeof(char)*M*blocksize);
-				}
-				else {
-					coding[erasures[i]-k] = (char *)malloc(sizeof(char)*blocksize);
-					tempcoding[erasures[i]-k] = (char *)malloc(sizeof(char)*M*blocksize);
-				}
-			}
+	/* Each node's readin is held as in its file, layer after layer, and
+	   is decoded where it was read: fdata[z] and fcoding[z] are views of
+	   layer z, with a node's sub-chunks alpha*blocksize apart.  With more
+	   than one readin there are two sets of buffers, so the next readin
+	   is read while this one is decoded and written. */
+	nbufs = (readins > 1) ? 2 : 1;
+	for (cur = 0; cur < nbufs; cur++) {
+		databuf[cur] = (char *)malloc((size_t)k*alpha*blocksize);
+		codingbuf[cur] = (char *)malloc((size_t)m*alpha*blocksize);
+		fdata_set[cur] = (char **)malloc(sizeof(char*)*alpha);
+		fcoding_set[cur] = (char **)malloc(sizeof(char*)*alpha);
+		if (databuf[cur] == NULL || codingbuf[cur] == NULL || fdata_set[cur] == NULL ||
+		    fcoding_set[cur] == NULL) {
+			fprintf(stderr, "Unable to allocate %lld bytes for a readin.\n",
+				(long long)(k+m)*alpha*blocksize);
+			exit(0);
+		}
+		for (z = 0; z < alpha; z++) {
+			fdata_set[cur][z] = databuf[cur] + (long)z*blocksize;
+			fcoding_set[cur][z] = codingbuf[cur] + (long)z*blocksize;
+		}
+	}
+	code->stride = (long)alpha*blocksize;
+
+	decoder_cache = NULL;
+	if (!healthy && (tech == Reed_Sol_Van || tech == Reed_Sol_R6_Op) && w == 8) {
+		decoder_cache = clay_decoder_cache_new(k, m, matrix, 0);
+		if (decoder_cache == NULL) {
+			fprintf(stderr, "Unsuccessful!\n");
+			exit(0);
+		}
+	}
+
+	/* Begin decoding process */
+	out_fd = -1;
+	total = 0;
+	read_readin(io, code, node_fd, node_name, fdata_set[0], fcoding_set[0], blocksize, 1);
+	n = 1;	
+	while (n <= readins) {
+		/* This readin was queued before; queue the next one behind it */
+		cur = (n-1) % nbufs;
+		fdata = fdata_set[cur];
+		fcoding = fcoding_set[cur];
+		wait_io(io, NULL, (long)alpha*blocksize);
+		if (n < readins) {
+			read_readin(io, code, node_fd, node_name, fdata_set[n % nbufs], fcoding_set[n % nbufs],
+				blocksize, n+1);
 		}
-		erasures[numerased] = -1;
 /*printf( " read original tempdata data first row---------------- :\n");
 			 for(i1=0;i1<1;i1++){
 	                        for(j1=0;j1<k*blocksize;j1++)
@@ -363,20 +560,7 @@ printf( " read original tempcoding data first row---------------- :\n");
 				printf( " \n");
 				}*/
 printf( " 1\n");
-fdata = (char **)malloc(sizeof(char*)*M);
-fcoding = (char **)malloc(sizeof(char*)*M);
-for(j = 0; j < M; j++) {
-fdata[j] = (char *)malloc(sizeof(char)*k*blocksize);
-fcoding[j] = (char *)malloc(sizeof(char)*m*blocksize);}
-char **ffdata;
-ffdata = (char **)malloc(sizeof(char*)*M);
-for(j = 0; j < M; j++) {
-ffdata[j] = (char *)malloc(sizeof(char)*k*blocksize);}
 printf( " 2\n");
-                 	for(i=0;i<M;i++){
-                 	for(j1=0;j1<k;j1++){
-                 	for(j=0;j<blocksize;j++){           
-                	 fdata[i][j+j1*blocksize]=*(tempdata[j1]+j+i*blocksize);}}}
                   	
    		/*printf( " read original fdata first row---------------- :\n");
 			 for(i1=0;i1<1;i1++){
@@ -396,10 +580,6 @@ printf( " 2\n");
 				}*/
 
 printf( " 3\n");
-     			 for(i=0;i<M;i++){
-    			 for(j1=0;j1<m;j1++){
-      			 for(j=0;j<blocksize;j++){
-      			 fcoding[i][j+j1*blocksize]=*(tempcoding[j1]+i*blocksize+j);}}}
 printf( " 44444444444\n");
 
                         /* printf( " read original fcoding  strip:\n");
@@ -639,8 +819,7 @@ for(i1 = 0; i1< blocksize; i1++) {
 printf("%d ",*(fdata[0] +blocksize+ i1));}
 printf( " \n");
 
-for(i1=0;i1<blocksize;i1++){
-factor[0][i1]=divide((*(fdata[0] + blocksize+i1)),cons[2]);}
+galois_w08_region_divide((fdata[0] + blocksize),cons[2],blocksize,factor[0],0);
 
 printf( " 7~\n");
 
@@ -673,8 +852,7 @@ printf( "6-- before2 :\n");
 for(i1 = 0; i1< blocksize; i1++) {
 printf("%d ",*(fdata[0+1]+i1));}
 printf( " \n");
-for(i1=0;i1<blocksize;i1++){
-fdata[0][blocksize+i1]=divide((*(fdata[0+1]+i1)),cons[2]);}//a 0,1
+galois_w08_region_divide(fdata[0+1],cons[2],blocksize,(fdata[0] + blocksize),0);//a 0,1
 
 printf( " 7--- divide 3  after2  should equal original fdata first row :\n");
 for(i1=0;i1<blocksize;i1++){
@@ -717,374 +895,16 @@ printf( " 12~\n");
 }}*/
 printf( " input data complete\n");
 printf( " bit_operation_start: \n");
-char **extra;
-char **factor;
-char *cons;
 timing_set(&t3);
 timing_set(&q5);
 timing_set(&q1);
 
-
-//char **extra;
-extra = (char **)malloc(sizeof(char*)*64);
-for(i = 0; i < 64; i++) {
-extra[i] = (char *)malloc(sizeof(char)*blocksize);}
-
-
-//char **factor;
-factor = (char **)malloc(sizeof(char*)*64);
-for(i = 0; i < 64; i++) {
-factor[i] = (char *)malloc(sizeof(char)*blocksize);}
-printf( " \n");
-
-
-//char *cons;
-cons = (char *)malloc(sizeof(char)*3);
-cons[0]=1;cons[1]=r;
-
-galois_region_xor1(&cons[0],&cons[1],(cons+2),1);
-//cons[2]=3;
-printf("cons[2]: %d ",*(cons+2));
-printf( " \n");	
-
-
-
-////////////////////	
-
-for(i=0;i<M;i++){//i=0 2 4 6 8 10 12 14 16..............
-
-	
-if( i%2 == 0){
-//save original value
-for(i1 = 0; i1< blocksize; i1++){
-extra[i/2][i1]=*(fdata[i+1] + i1);}
-
-//oringinal two element XOR---save in first row
-			
-
-galois_w8_region_xor(fdata[i+1],(fdata[i] + blocksize),blocksize);
-			
-
-//for(i1=0;i1<blocksize;i1++){
-//factor[i/2][i1]=divide((*(fdata[i] + blocksize+i1)),cons[2]);}
-
-
-
-
-
-galois_w08_region_multiply((fdata[i] + blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[i/2], 0);
-
-
-
-
-
-			
-//get the factor
-
-galois_w8_region_xor(factor[i/2],fdata[i+1],blocksize);
-			
-//second row \times inverse element ---get value first row  save in first row
-
-
-
-//for(i1=0;i1<blocksize;i1++){
-//fdata[i][blocksize+i1]=divide((*(fdata[i+1]+i1)),cons[2]);}//a 0,1
-
-
-galois_w08_region_multiply(fdata[i+1], galois_single_divide(1,cons[2],w), blocksize,(fdata[i] + blocksize), 0);
-
-
-			
-				
-//value \times parameter r   ----save in second row
-
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fdata[i] + blocksize), r, blocksize, (fdata[i+1]), 0);//}
-
-
-//second row  XOR original value  --get value second row 
-
-galois_w8_region_xor(extra[i/2],fdata[i+1],blocksize);//a 1,0  
-}}
-
-
-
-
-
-		
-/////////////////
-
-//printf( " 2--\n");
-for(i=0;i<M;i++){	
-if( i%4 == 0){//i= 0 4 8 
-//printf( " 2--0\n");
-for(j1=0;j1<2;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+2+j1] +2*blocksize+ i1);}}
-
-
-
-//printf( " 2--1\n");
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor((fdata[i+2+j1]+2*blocksize),(fdata[i+j1] + 3*blocksize),blocksize);}
-
-//printf( " 2--2\n");
-for(j1=0;j1<2;j1++){
-
-
-
-
-
-//for(i1=0;i1<blocksize;i1++){
-//factor[j1][i1]=divide((*(fdata[i+j1] + 3*blocksize+i1)),cons[2]);}}
-
-galois_w08_region_multiply((fdata[i+j1] + 3*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}
-
-
-
-
-
-//printf( " 2--3\n");
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor(factor[j1],(fdata[i+j1+2]+2*blocksize),blocksize);}
-
-//printf( " 2--4\n");
-for(j1=0;j1<2;j1++){
-
-
-
-//for(i1=0;i1<blocksize;i1++){
-//fdata[i+j1][3*blocksize+i1]=divide((*(fdata[i+j1+2]+2*blocksize+i1)),cons[2]);}}//a 0,1
-galois_w08_region_multiply((fdata[i+j1+2]+2*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i+j1] + 3*blocksize), 0);}
-
-
-
-
-
-//printf( " 2--5\n");
-for(j1=0;j1<2;j1++){
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fdata[i+j1] + 3*blocksize), r, blocksize, (fdata[i+2+j1]+2*blocksize), 0);}//}
-
-
-//printf( " 2--6\n");
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+2+j1]+2*blocksize),blocksize);}//a 1,0  
-}}
-
-		/*printf( " recovery original fdata a-------------:\n");
-			
-	                        for(j1=0;j1<blocksize;j1++)
-                                   {
-					printf("%d ",fdata[1][j1]);
-			           }
-				printf( " \n");*/
-					//}
-	        /*printf( " read encoded fcoding first strip   :\n");
-			
-	
-			 for(i1=0;i1<1;i1++){
-	                        for(j1=0;j1<m*blocksize;j1++){
-                                  
-				printf("%d ",fcoding[i1][j1]);}
-     				printf( " \n");	}
-			   printf( " \n");*/
-
-
-//////////////////////
-//printf( " 3--\n");
-for(i=0;i<M;i++){	
-if( i%8 == 0){
-
-for(j1=0;j1<4;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+4+j1] +4*blocksize+ i1);}}
-
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor((fdata[i+4+j1]+4*blocksize),(fdata[i+j1] + 5*blocksize),blocksize);}
-
-
-for(j1=0;j1<4;j1++){
-
-//for(i1=0;i1<blocksize;i1++){
-//factor[j1][i1]=divide((*(fdata[i+j1] + 5*blocksize+i1)),cons[2]);}}
-galois_w08_region_multiply((fdata[i+j1] + 5*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor(factor[j1],(fdata[i+j1+4]+4*blocksize),blocksize);}
-
-
-
-for(j1=0;j1<4;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//fdata[i+j1][5*blocksize+i1]=divide((*(fdata[i+j1+4]+4*blocksize+i1)),cons[2]);}}//a 0,1
-galois_w08_region_multiply((fdata[i+j1+4]+4*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i+j1] + 5*blocksize), 0);}
-
-
-for(j1=0;j1<4;j1++){
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fdata[i+j1] + 5*blocksize), r, blocksize, (fdata[i+4+j1]+4*blocksize), 0);}//}
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+4+j1]+4*blocksize),blocksize);}//a 1,0  
-}}
-/////////////////
-//printf( " 4--\n");
-for(i=0;i<M;i++){	
-if( i%16 == 0){
-
-for(j1=0;j1<8;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+8+j1] +6*blocksize+ i1);}}
-
-
-
-
-for(j1=0;j1<8;j1++){
-galois_w8_region_xor((fdata[i+8+j1]+6*blocksize),(fdata[i+j1] + 7*blocksize),blocksize);}
-
-
-for(j1=0;j1<8;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//factor[j1][i1]=divide((*(fdata[i+j1] + 7*blocksize+i1)),cons[2]);}}
-galois_w08_region_multiply((fdata[i+j1] + 7*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}
-
-for(j1=0;j1<8;j1++){
-galois_w8_region_xor(factor[j1],(fdata[i+j1+8]+6*blocksize),blocksize);}
-
-
-
-for(j1=0;j1<8;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//fdata[i+j1][7*blocksize+i1]=divide((*(fdata[i+j1+8]+6*blocksize+i1)),cons[2]);}}//a 0,1
-galois_w08_region_multiply((fdata[i+j1+8]+6*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i+j1] + 7*blocksize), 0);}
-
-
-for(j1=0;j1<8;j1++){
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fdata[i+j1] + 7*blocksize), r, blocksize, (fdata[i+8+j1]+6*blocksize), 0);}//}
-
-
-
-for(j1=0;j1<8;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+8+j1]+6*blocksize),blocksize);}//a 1,0  
-}}
-//////////////////////////////////////////////
-//printf( " 5--\n");
-for(i=0;i<M;i++){	
-if( i%32 == 0){
-
-for(j1=0;j1<16;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+16+j1] +8*blocksize+ i1);}}
-
-
-for(j1=0;j1<16;j1++){
-galois_w8_region_xor((fdata[i+16+j1]+8*blocksize),(fdata[i+j1] + 9*blocksize),blocksize);}
-
-
-for(j1=0;j1<16;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//factor[j1][i1]=divide((*(fdata[i+j1] + 9*blocksize+i1)),cons[2]);}}
-galois_w08_region_multiply((fdata[i+j1] + 9*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}
-
-for(j1=0;j1<16;j1++){
-galois_w8_region_xor(factor[j1],(fdata[i+j1+16]+8*blocksize),blocksize);}
-
-
-
-for(j1=0;j1<16;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//fdata[i+j1][9*blocksize+i1]=divide((*(fdata[i+j1+16]+8*blocksize+i1)),cons[2]);}}//a 0,1
-galois_w08_region_multiply((fdata[i+j1+16]+8*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i+j1] + 9*blocksize), 0);}
-
-
-for(j1=0;j1<16;j1++){
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fdata[i+j1] + 9*blocksize), r, blocksize, (fdata[i+16+j1]+8*blocksize), 0);}//}
-
-
-
-for(j1=0;j1<16;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+16+j1]+8*blocksize),blocksize);}//a 1,0  
-}}
-
-/////////////////////////////////////////
-//printf( " 6--\n");
-for(i=0;i<M;i++){	
-if( i%64 == 0){
-
-for(j1=0;j1<32;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fcoding[i+32+j1] + i1);}}
-
-for(j1=0;j1<32;j1++){
-galois_w8_region_xor(fcoding[i+32+j1],(fcoding[i+j1] + blocksize),blocksize);}
-
-for(j1=0;j1<32;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//factor[j1][i1]=divide((*(fcoding[i+j1] +blocksize+i1)),cons[2]);}}
-galois_w08_region_multiply((fcoding[i+j1] + blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}
-
-
-for(j1=0;j1<32;j1++){
-galois_w8_region_xor(factor[j1],fcoding[i+j1+32],blocksize);}
-
-for(j1=0;j1<32;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//fcoding[i+j1][blocksize+i1]=divide((*(fcoding[i+j1+32]+i1)),cons[2]);}}//a 0,1
-galois_w08_region_multiply(fcoding[i+j1+32], galois_single_divide(1,cons[2],w), blocksize, (fcoding[i+j1] + blocksize), 0);}
-
-
-for(j1=0;j1<32;j1++){
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fcoding[i+j1] + blocksize), r, blocksize, (fcoding[i+32+j1]), 0);}//}
-
-for(j1=0;j1<32;j1++){
-galois_w8_region_xor(extra[j1],fcoding[i+32+j1],blocksize);}//a 1,0  
-}}
-/////////////////////////////////////////
-//printf( " 7--\n");
-for(i=0;i<M;i++){	
-if( i%128 == 0){
-
-for(j1=0;j1<64;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fcoding[i+64+j1]+2*blocksize + i1);}}
-
-for(j1=0;j1<64;j1++){
-galois_w8_region_xor((fcoding[i+64+j1]+2*blocksize),(fcoding[i+j1] + 3*blocksize),blocksize);}
-
-for(j1=0;j1<64;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//factor[j1][i1]=divide((*(fcoding[i+j1] +3*blocksize+i1)),cons[2]);}}
-galois_w08_region_multiply((fcoding[i+j1] + 3*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}
-
-
-
-for(j1=0;j1<64;j1++){
-galois_w8_region_xor(factor[j1],(fcoding[i+j1+64]+2*blocksize),blocksize);}
-
-for(j1=0;j1<64;j1++){
-//for(i1=0;i1<blocksize;i1++){
-//fcoding[i+j1][3*blocksize+i1]=divide((*(fcoding[i+j1+64]+2*blocksize+i1)),cons[2]);}}//a 0,1
-galois_w08_region_multiply((fcoding[i+j1+64]+2*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fcoding[i+j1] + 3*blocksize), 0);}
-
-
-for(j1=0;j1<64;j1++){
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fcoding[i+j1] + 3*blocksize), r, blocksize, (fcoding[i+64+j1]+2*blocksize), 0);}//}
-
-
-for(j1=0;j1<64;j1++){
-galois_w8_region_xor(extra[j1],(fcoding[i+64+j1]+2*blocksize),blocksize);}//a 1,0  
-}}
-
+/* Undo the coupling: one kernel call restores both uncoupled
+   sub-chunks of a pair in place.  With nodes missing the pairs are
+   worked on along with the layers below. */
+if (data_plan != NULL) {
+clay_plan_decouple(data_plan, code, coupler, fdata, fcoding, blocksize);
+}
 timing_set(&q2);
 printf( "bit_operation_ended \n");
 
@@ -1115,48 +935,39 @@ printf( "decoding: \n");
 		
 		//sprintf(fname, "%s/Coding/%s_decoded%s", curdir, cs1, extension);
 		//fp = fopen(fname, "ab");
-		int i3;
-		int ii;
 		int i2;
 		int i4;
-		int jj;
-		int i5;
-	
-		
-		for(ii=0;ii<M;ii++){
-
-		
-		for(jj=0;jj<m;jj++){		
-		coding[jj] = (fcoding[ii]+jj*blocksize);}
-		for(j=0;j<k;j++){
-		data[j] = (fdata[ii]+j*blocksize);}
-
-		
-
-
-
-		/* Choose proper decoding method */
-		if (tech == Reed_Sol_Van || tech == Reed_Sol_R6_Op) {
-			i3 = jerasure_matrix_decode(k, m, w, matrix, 0, erasures, data, coding, blocksize);
+		const clay_layer_decoder *layer_decoder;
+
+		/* The erasure pattern is the same for every layer, so the decoding
+		   rows come from the cache and all layers stream through them. */
+		layer_decoder = NULL;
+		if (decoder_cache != NULL) {
+			layer_decoder = clay_decoder_cache_get(decoder_cache, erased);
+			if (layer_decoder == NULL) {
+				fprintf(stderr, "Unsuccessful!\n");
+				exit(0);
+			}
 		}
-		if (i3 == -1) {
-			fprintf(stderr, "Unsuccessful!\n");
-			exit(0);
-		}								
-		
-
-
-		/*int p,pp;
-		for(p=0;p<k;p++){
-		for(i2=0;i2<blocksize;i2++){
-		ffdata[ii][pp]=*(data[p]+i2);
-		pp++;}}
-		pp=0;*/
-
-
-
-
-		}//M circle
+		lj.tech = tech;
+		lj.k = k;
+		lj.m = m;
+		lj.w = w;
+		lj.packetsize = packetsize;
+		lj.matrix = matrix;
+		lj.bitmatrix = bitmatrix;
+		lj.erasures = erasures;
+		lj.layer_decoder = layer_decoder;
+		lj.fdata = fdata;
+		lj.fcoding = fcoding;
+		lj.blocksize = blocksize;
+		lj.stride = code->stride;
+
+		if (decode_plan != NULL) {
+			clay_code_decode(decode_plan, code, coupler, fdata, fcoding, blocksize, 0, blocksize,
+				decode_layer, &lj);
+		}
+		clay_decoder_cache_put(decoder_cache, layer_decoder);
 timing_set(&q4);
 timing_set(&q6);
 timing_set(&t4);
@@ -1166,40 +977,34 @@ printf( "decode complete \n");
 //printf( " decoded :\n");
 
 		
-		/* Create decoded file */
+		/* Create decoded file: the layers up to the original size, each
+		   gathered from the data nodes, in one write */
 		sprintf(fname, "%s/Coding/%s_decoded%s", curdir, cs1, extension);
 		if (n == 1) {
-			fp = fopen(fname, "wb");
-		}
-		else {
-			fp = fopen(fname, "ab");
+			out_fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (out_fd < 0) {
+				fprintf(stderr, "Unable to create %s.\n", fname);
+				exit(0);
+			}
 		}
 		
-		for (i4 = 0; i4 < M; i4++) {
-		//for (i1 = 0; i1 < k; i1++) {
-			//if (total+blocksize <= origsize) {
-			//  fwrite(data[i1], sizeof(char), blocksize, fp);
-			 // total+= blocksize;}
-
-			if (total+k*blocksize <= origsize) {
-			   //fwrite(ffdata[i4], sizeof(char), k*blocksize, fp);
-				fwrite(fdata[i4], sizeof(char), k*blocksize, fp);
-			   total+= k*blocksize;}
-			   
-			else {
-				//for (j = 0; j < blocksize; j++) {
-				for (i5 = 0; i5 < k*blocksize; i5++) {
-					if (total < origsize) {
-						//fprintf(fp, "%c", ffdata[i4][i5]);
-						fprintf(fp, "%c", fdata[i4][i5]);
-						total++;
-					}
-					else {
-						break;
-					}
-					
-				}
-			}//else
+		j = 0;
+		out_pos = total;
+		for (i4 = 0; i4 < alpha && total < origsize; i4++) {
+			for (i = 0; i < k && total < origsize; i++) {
+				out_iov[j].iov_base = clay_code_subchunk(code, fdata, fcoding, i, i4, blocksize);
+				out_iov[j].iov_len = (total+blocksize <= origsize) ? blocksize : origsize-total;
+				total += out_iov[j].iov_len;
+				j++;
+			}
+		}
+		if (j > 0) {
+			if (clay_io_writev(io, out_fd, out_iov, j, out_pos, fname) < 0 ||
+			    clay_io_submit(io) < 0) {
+				fprintf(stderr, "Unable to write %s.\n", fname);
+				exit(0);
+			}
+			wait_io(io, fname, (long)alpha*blocksize);
 		}
 
 
@@ -1221,7 +1026,6 @@ printf( " end~\n");
 
 
 		n++;
-		fclose(fp);
 		totalsec += timing_delta(&t3, &t4);
 		bit_operation_time= timing_delta(&q1, &q2);
 		decode_time= timing_delta(&q3, &q4);
@@ -1230,6 +1034,17 @@ printf( " end~\n");
 
 
 	}//while
+	for (i = 0; i < k+m; i++) {
+		if (node_fd[i] >= 0) {
+			close(node_fd[i]);
+		}
+		free(node_name[i]);
+	}
+	free(node_name);
+	if (out_fd >= 0) {
+		close(out_fd);
+	}
+	clay_io_free(io);
 	
 	/* Free allocated memory */
 	free(cs1);
@@ -1239,6 +1054,17 @@ printf( " end~\n");
 	free(coding);
 	free(erasures);
 	free(erased);
+	clay_decode_plan_free(decode_plan);
+	clay_plan_free(data_plan);
+	clay_decoder_cache_free(decoder_cache);
+	for (cur = 0; cur < nbufs; cur++) {
+		free(fdata_set[cur]);
+		free(fcoding_set[cur]);
+		free(databuf[cur]);
+		free(codingbuf[cur]);
+	}
+	clay_coupler_free(coupler);
+	clay_code_free(code);
 	
 	/* Stop timing and print time */
 	timing_set(&t2);
@@ -59,6 +59,9 @@ is the file name with "_k#" or "_m#" and then the extension.
 #include <time.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
@@ -72,10 +75,16 @@ is the file name with "_k#" or "_m#" and then the extension.
 #include "cauchy.h"
 #include "liberation.h"
 #include "timing.h"
+#include "galois_ext.h"
+#include "clay.h"
+#include "clay_pool.h"
+#include "clay_io.h"
+#include <pthread.h>
 
 #define N 10
-#define M 128
 #define r 2
+/* Input bytes per readin when the buffersize argument is 0 */
+#define DEFAULT_STRIPE_BYTES (64LL << 20)
 enum Coding_Technique {Reed_Sol_Van, Reed_Sol_R6_Op, Cauchy_Orig, Cauchy_Good, Liberation, Blaum_Roth, Liber8tion, RDP, EVENODD, No_Coding};
 
 char *Methods[N] = {"reed_sol_van", "reed_sol_r6_op", "cauchy_orig", "cauchy_good", "liberation", "blaum_roth", "liber8tion", "no_coding"};
@@ -134,38 +143,396 @@ static void print_data_and_coding(int k, int m, int w, int size,
 	printf("\n");
 }
 
+/* Base-code encode of one layer: the m parity sub-chunks from the k data
+   sub-chunks, size bytes each */
+static void encode_layer(enum Coding_Technique tech, int k, int m, int w, int *matrix,
+	galois_w08_tables *dot_tables, int **schedule, int packetsize,
+	char **data, char **coding, int size)
+{
+	switch(tech) {	
+		case No_Coding:
+			break;
+		case Reed_Sol_Van:
+			/* One pass over the k data sub-chunks produces all m parities */
+			if (dot_tables != NULL) {
+				galois_w08_region_dot_prod(k, m, dot_tables, data, coding, size);
+			}
+			else {
+				jerasure_matrix_encode(k, m, w, matrix, data, coding, size);
+			}
+			break;
+		case Reed_Sol_R6_Op:
+			reed_sol_r6_encode(k, w, data, coding, size);
+			break;
+		case Cauchy_Orig:
+			jerasure_schedule_encode(k, m, w, schedule, data, coding, size, packetsize);
+			break;
+		case Cauchy_Good:
+			jerasure_schedule_encode(k, m, w, schedule, data, coding, size, packetsize);
+			break;
+		case Liberation:
+			jerasure_schedule_encode(k, m, w, schedule, data, coding, size, packetsize);
+			break;
+		case Blaum_Roth:
+			jerasure_schedule_encode(k, m, w, schedule, data, coding, size, packetsize);
+			break;
+		case Liber8tion:
+			jerasure_schedule_encode(k, m, w, schedule, data, coding, size, packetsize);
+			break;
+		case RDP:
+		case EVENODD:
+			assert(0);
+	}
+}
+
+/* What the encode tasks of one readin share */
+struct encode_job {
+	enum Coding_Technique tech;
+	int k, m, w, packetsize;
+	int *matrix;
+	galois_w08_tables *dot_tables;
+	int **schedule;
+	char **fdata;
+	char **fcoding;
+	int blocksize;
+	int tile;
+	clay_deps *deps;			// pairs waiting for their layers
+	clay_decode_plan *sys;			// --systematic: parities as erasures
+	clay_code *code;
+	clay_coupler *coupler;
+};
+
+/* Task j: make layer j's parities, then couple the pairs whose other
+   layer is already done.  Every coupled pair of
+   sub-chunks is rewritten in place by one kernel call.  Every sub-chunk
+   is coupled at most once and then only written out, so the coupled
+   results may bypass the cache (CLAY_NT_STORES). */
+static void encode_layer_task(void *arg, int j)
+{
+	struct encode_job *job = arg;
+	char *data[job->k];
+	char *coding[job->m];
+	int i;
+
+	for (i = 0; i < job->k; i++) {
+		data[i] = job->fdata[j] + i*job->blocksize;
+	}
+	for (i = 0; i < job->m; i++) {
+		coding[i] = job->fcoding[j] + i*job->blocksize;
+	}
+	encode_layer(job->tech, job->k, job->m, job->w, job->matrix, job->dot_tables, job->schedule,
+		job->packetsize, data, coding, job->blocksize);
+	clay_deps_layer_done(job->deps, j, job->code, job->coupler, job->fdata, job->fcoding,
+		job->blocksize);
+}
+
+/* Systematic encoding decodes the parity nodes of every layer: with the
+   data nodes' uncoupled sub-chunks in hand, that is the base-code encode */
+static void encode_sys_layer(void *arg, int z, int off, int len)
+{
+	struct encode_job *job = arg;
+	char *data[job->k];
+	char *coding[job->m];
+	int i;
+
+	for (i = 0; i < job->k; i++) {
+		data[i] = job->fdata[z] + i*job->blocksize + off;
+	}
+	for (i = 0; i < job->m; i++) {
+		coding[i] = job->fcoding[z] + i*job->blocksize + off;
+	}
+	encode_layer(job->tech, job->k, job->m, job->w, job->matrix, job->dot_tables, job->schedule,
+		job->packetsize, data, coding, len);
+}
+
+/* Task t: push byte column [off, off+len) of every sub-chunk through the
+   base code and the coupling, so the alpha*(k+m)*tile bytes being worked
+   on stay cached.  Both are bytewise (packet-groupwise for the cauchy
+   codes), so the result is the same as untiled. */
+static void encode_tile_task(void *arg, int t)
+{
+	struct encode_job *job = arg;
+	char *data[job->k];
+	char *coding[job->m];
+	int i, j, off, len;
+
+	off = t*job->tile;
+	len = job->blocksize - off;
+	if (len > job->tile) {
+		len = job->tile;
+	}
+	if (job->sys != NULL) {
+		clay_code_decode(job->sys, job->code, job->coupler, job->fdata, job->fcoding,
+			job->blocksize, off, len, encode_sys_layer, job);
+		return;
+	}
+	for (j = 0; j < job->code->alpha; j++) {
+		for (i = 0; i < job->k; i++) {
+			data[i] = job->fdata[j] + i*job->blocksize + off;
+		}
+		for (i = 0; i < job->m; i++) {
+			coding[i] = job->fcoding[j] + i*job->blocksize + off;
+		}
+		encode_layer(job->tech, job->k, job->m, job->w, job->matrix, job->dot_tables, job->schedule,
+			job->packetsize, data, coding, len);
+	}
+	clay_plan_couple_tile(job->code->plan, job->code, job->coupler, job->fdata, job->fcoding,
+		job->blocksize, off, len);
+}
+
+static long long gcd(long long a, long long b)
+{
+	long long t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* One readin on its way through the pipeline: the reader fills block,
+   the encoder makes the parities and couples in place, then the writer
+   appends every node's sub-chunks to its file.  When the last of those
+   writes completes the stripe goes back to the reader.
+
+   All of it lives in one arena: the buffer as read, which is the alpha
+   layers of k data sub-chunks back to back, followed by the alpha layers
+   of m parity sub-chunks.  fdata[j] and fcoding[j] point into it, so the
+   read needs no copy and memory stays the same for any number of
+   readins. */
+struct stripe {
+	int n;					// readin number, from 1
+	int index;				// registered buffer number
+	char *block;				// the arena, data first
+	long bytes;
+	char **fdata;
+	char **fcoding;
+	struct iovec *iov;			// alpha per node, for its write
+	int writers;				// node writes not done yet
+};
+
+struct stripe_reader {
+	FILE *fp;
+	long long size, buffersize;
+	struct stripe *stripes;
+	int nstripes;
+	clay_queue *free;			// stripes to fill
+	clay_queue *full;			// to the encoder, in readin order
+	pthread_t thread;
+};
+
+struct node_file {
+	int fd;					// open for the whole run
+	off_t pos;				// where the next stripe goes
+	int off;				// of this node's sub-chunk in a layer
+	int coding;				// node is in fcoding, not fdata
+};
+
+struct stripe_writer {
+	struct node_file *nodes;
+	int nnodes;
+	int alpha, blocksize;
+	int depth;				// node writes in flight at most
+	clay_queue *queue;			// encoded stripes; NULL ends the run
+	clay_queue *free;
+	pthread_t thread;
+};
+
+/* A zeroed arena aligned to a cache line, or with huge set to a 2 MB
+   huge page where the kernel offers them */
+static char *stripe_arena_new(long bytes, int huge)
+{
+	void *p;
+	long align;
+
+	align = 64;
+	if (huge) {
+		align = 2L << 20;
+		bytes = (bytes + align - 1) / align * align;
+	}
+	if (posix_memalign(&p, align, bytes) != 0) {
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if (huge) {
+		madvise(p, bytes, MADV_HUGEPAGE);
+	}
+#endif
+	memset(p, 0, bytes);
+	return (char *)p;
+}
+
+/* Reads len bytes of the input at off into st's arena, or makes them up
+   for a "-size" input; returns how many there were */
+static long read_block(struct stripe_reader *rd, clay_io *io, struct stripe *st, long len,
+	long long off)
+{
+	void *tag;
+	long res;
+
+	if (rd->fp == NULL) {
+		return jfread(st->block, sizeof(char), len, rd->fp);
+	}
+	if (clay_io_read(io, fileno(rd->fp), st->block, len, off, st->index, st) < 0 ||
+	    clay_io_submit(io) < 0 || clay_io_wait(io, &tag, &res) < 0 || res < 0) {
+		fprintf(stderr, "Unable to read the input file.\n");
+		exit(0);
+	}
+	return res;
+}
+
+/* Reader stage: fills free stripes with the next buffer.  The input ends
+   somewhere in the last readin or two; the rest is zeros.  The arenas are
+   registered with the I/O engine, so io_uring reads into them without
+   pinning pages every time. */
+static void *read_stripes(void *arg)
+{
+	struct stripe_reader *rd = arg;
+	struct stripe *st;
+	struct iovec bufs[rd->nstripes];
+	clay_io *io;
+	long long total;
+	long got;
+	int i, nr;
+
+	io = clay_io_new(1);
+	if (io == NULL) {
+		fprintf(stderr, "Unable to set up input.\n");
+		exit(0);
+	}
+	for (i = 0; i < rd->nstripes; i++) {
+		bufs[i].iov_base = rd->stripes[i].block;
+		bufs[i].iov_len = rd->stripes[i].bytes;
+	}
+	clay_io_register(io, bufs, rd->nstripes);
+
+	total = 0;
+	for (nr = 1; nr <= readins; nr++) {
+		st = clay_queue_pop(rd->free);
+		got = 0;
+		if (total < rd->size) {
+			got = rd->size - total;
+			if (got > rd->buffersize) {
+				got = rd->buffersize;
+			}
+			got = read_block(rd, io, st, got, total);
+			total += got;
+		}
+		if (got < rd->buffersize) {
+			memset(st->block + got, 0, rd->buffersize - got);
+		}
+		st->n = nr;
+		clay_queue_push(rd->full, st);
+	}
+	clay_io_free(io);
+	return NULL;
+}
+
+/* Writer stage: every encoded stripe becomes one gathered write of alpha
+   sub-chunks per node file, at the end of what the file holds so far, so
+   the files grow in readin order whatever order the writes finish in.
+   The writes of several stripes can be in flight at once; new stripes are
+   taken as they come and completions reaped in between. */
+static void *write_stripes(void *arg)
+{
+	struct stripe_writer *wr = arg;
+	struct stripe *st;
+	struct node_file *nf;
+	char **sub;
+	clay_io *io;
+	void *item;
+	long res;
+	int i, j, ended;
+
+	io = clay_io_new(wr->depth);
+	if (io == NULL) {
+		fprintf(stderr, "Unable to set up output.\n");
+		exit(0);
+	}
+	ended = 0;
+	while (!ended || clay_io_outstanding(io) > 0) {
+		if (!ended && clay_io_outstanding(io) == 0) {
+			item = clay_queue_pop(wr->queue);
+		}
+		else if (ended || !clay_queue_trypop(wr->queue, &item)) {
+			res = -EIO;
+			if (clay_io_wait(io, &item, &res) < 0 || res != (long)wr->alpha*wr->blocksize) {
+				fprintf(stderr, "Unable to write a node file: %s\n",
+					res < 0 ? strerror(-res) : "short write");
+				exit(0);
+			}
+			st = item;
+			if (--st->writers == 0) {
+				clay_queue_push(wr->free, st);
+			}
+			continue;
+		}
+		if (item == NULL) {
+			ended = 1;
+			continue;
+		}
+		st = item;
+		st->writers = wr->nnodes;
+		for (i = 0; i < wr->nnodes; i++) {
+			nf = &wr->nodes[i];
+			sub = nf->coding ? st->fcoding : st->fdata;
+			for (j = 0; j < wr->alpha; j++) {
+				st->iov[i*wr->alpha+j].iov_base = sub[j] + nf->off;
+				st->iov[i*wr->alpha+j].iov_len = wr->blocksize;
+			}
+			clay_io_writev(io, nf->fd, st->iov + i*wr->alpha, wr->alpha, nf->pos, st);
+			nf->pos += (off_t)wr->alpha*wr->blocksize;
+		}
+		clay_io_submit(io);
+	}
+	clay_io_free(io);
+	return NULL;
+}
+
 int main (int argc, char **argv) {
 	FILE *fp, *fp2;				// file pointers
-	char *block;				// padding file
-	int size, newsize;			// size of file and temp size 
+	long long size, newsize;		// size of file and temp size 
+	long long unit;				// readins are multiples of this
 	struct stat status;			// finding file size
 
 	
 	enum Coding_Technique tech;		// coding technique (parameter)
 	int k, m, w, packetsize;		// parameters
-	int buffersize;					// paramter
+	int d;						// repair degree, q = d-k+1
+	long long buffersize;				// input bytes per readin
 	int i,j,i1,j1,i2,j2;
-	int i22,iii;						// loop control variables
 	int blocksize;					// size of k+m files
-	int total;
-	int extra3;
-	int stripe_size;
+	long long stripe_size;
 	
 	/* Jerasure Arguments */
-	char **data;				
-	char **coding;
 	char **fdata;				
 	char **fcoding;
 	//char **ccoding;
 	int *matrix;
 	int *bitmatrix;
 	int **schedule;
+	galois_w08_tables *dot_tables;
+	clay_coupler *coupler;				// pairwise coupling transform
+	clay_code *code;				// node/layer layout
+	int alpha;					// layers per node
+	int tile;					// column tiling (CLAY_TILE)
+	int threads;					// --threads
+	int systematic;					// --systematic
+	int *erased;
+	clay_pool *pool;
+	struct encode_job job;
+	int nstripes;					// readins in flight (CLAY_STRIPES)
+	struct stripe *stripes, *st;
+	struct stripe_reader reader;
+	struct stripe_writer writer;
+	clay_queue *free_stripes;
+	long databytes;					// data part of a stripe arena
+	int huge;					// CLAY_HUGEPAGES
 	//char *datacopy1;
 	//char *datacopy2;
-        char *extra1;
-	char *extra2;
        // char *datacopy;
-	char **extra;
 
         char **A;					
         char *A1;
@@ -183,17 +550,14 @@ int main (int argc, char **argv) {
 	char *curdir;
 	
 	/* Timing variables */
-	struct timing t1, t2, t3, t4,q1,q2,q3,q4,q5,q6;
+	struct timing t1, t2, t3, t4,q1,q2,q5,q6;
 
 	double tsec;
 	double totalsec;
 	double encode_time;
-	double bit_operation_time;
 	double sum_time;
 	struct timing start;
 
-	/* Find buffersize */
-	int up, down;
 
 
 	signal(SIGQUIT, ctrl_bs_handler);
@@ -204,13 +568,46 @@ int main (int argc, char **argv) {
 	matrix = NULL;
 	bitmatrix = NULL;
 	schedule = NULL;
+	dot_tables = NULL;
+
+	coupler = NULL;
+	code = NULL;
 	
+	/* --threads N and --systematic may come anywhere; take them out
+	   before reading the positional arguments */
+	threads = 1;
+	systematic = 0;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--systematic") == 0) {
+			systematic = 1;
+			for (j = i; j+1 <= argc; j++) {
+				argv[j] = argv[j+1];
+			}
+			argc--;
+			i--;
+			continue;
+		}
+		if (strcmp(argv[i], "--threads") == 0) {
+			if (i+1 >= argc || sscanf(argv[i+1], "%d", &threads) != 1 || threads <= 0) {
+				fprintf(stderr, "Invalid value for --threads\n");
+				exit(0);
+			}
+			for (j = i; j+2 <= argc; j++) {
+				argv[j] = argv[j+2];
+			}
+			argc -= 2;
+			i--;
+		}
+	}
+
 	/* Error check Arguments*/
-	if (argc != 8) {
-		fprintf(stderr,  "usage: inputfile k m coding_technique w packetsize buffersize\n");
+	if (argc != 8 && argc != 9) {
+		fprintf(stderr,  "usage: inputfile k m coding_technique w packetsize buffersize [d] [--threads N] [--systematic]\n");
 		fprintf(stderr,  "\nChoose one of the following coding techniques: \nreed_sol_van, \nreed_sol_r6_op, \ncauchy_orig, \ncauchy_good, \nliberation, \nblaum_roth, \nliber8tion");
 		fprintf(stderr,  "\n\nPacketsize is ignored for the reed_sol's");
-		fprintf(stderr,  "\nBuffersize of 0 means the buffersize is chosen automatically.\n");
+		fprintf(stderr,  "\nBuffersize is the input bytes per readin; 0 means 64 MB readins.\n");
+		fprintf(stderr,  "\nd is the number of helpers a repair reads from, k < d < k+m, and k+m must be a multiple of d-k+1; the default is k+1.\n");
+		fprintf(stderr,  "\n--systematic stores the input unchanged in the data files and codes only the parities.\n");
 		fprintf(stderr,  "\nIf you just want to test speed, use an inputfile of \"-number\" where number is the size of the fake file you want to test.\n\n");
 		exit(0);
 	}
@@ -236,52 +633,31 @@ int main (int argc, char **argv) {
 			exit(0);
 		}
 	}
-	if (argc != 8) {
+	if (argc < 8) {
 		buffersize = 0;
 	}
 	else {
-		if (sscanf(argv[7], "%d", &buffersize) == 0 || buffersize < 0) {
+		if (sscanf(argv[7], "%lld", &buffersize) == 0 || buffersize < 0) {
 			fprintf(stderr, "Invalid value for buffersize\n");
 			exit(0);
 		}
 		
 	}
-
-	/* Determine proper buffersize by finding the closest valid buffersize to the input value  */
-	if (buffersize != 0) {
-		if (packetsize != 0 && buffersize%(sizeof(long)*w*k*packetsize) != 0) { 
-			up = buffersize;
-			down = buffersize;
-			while (up%(sizeof(long)*w*k*packetsize) != 0 && (down%(sizeof(long)*w*k*packetsize) != 0)) {
-				up++;
-				if (down == 0) {
-					down--;
-				}
-			}
-			if (up%(sizeof(long)*w*k*packetsize) == 0) {
-				buffersize = up;
-			}
-			else {
-				if (down != 0) {
-					buffersize = down;
-				}
-			}
-		}
-		else if (packetsize == 0 && buffersize%(sizeof(long)*w*k) != 0) {
-			up = buffersize;
-			down = buffersize;
-			while (up%(sizeof(long)*w*k) != 0 && down%(sizeof(long)*w*k) != 0) {
-				up++;
-				down--;
-			}
-			if (up%(sizeof(long)*w*k) == 0) {
-				buffersize = up;
-			}
-			else {
-				buffersize = down;
-			}
+	if (argc == 9) {
+		if (sscanf(argv[8], "%d", &d) == 0) {
+			fprintf(stderr, "Invalid value for d\n");
+			exit(0);
 		}
 	}
+	else {
+		d = k + 1;
+	}
+	code = clay_code_new(k + m, k, d);
+	if (code == NULL) {
+		fprintf(stderr, "No Clay layout for n=%d k=%d d=%d: need k < d < n with n a multiple of d-k+1\n", k + m, k, d);
+		exit(0);
+	}
+	alpha = code->alpha;
 
 	/* Setting of coding technique and error checking */
 	
@@ -409,7 +785,7 @@ int main (int argc, char **argv) {
 		stat(argv[1], &status);	
 		size = status.st_size;
         } else {
-        	if (sscanf(argv[1]+1, "%d", &size) != 1 || size <= 0) {
+        	if (sscanf(argv[1]+1, "%lld", &size) != 1 || size <= 0) {
                 	fprintf(stderr, "Files starting with '-' should be sizes for randomly created input\n");
 			exit(1);
 		}
@@ -417,28 +793,34 @@ int main (int argc, char **argv) {
 		MOA_Seed(time(0));
         }
 
-	newsize = size;
-	
-	/* Find new size by determining next closest multiple */
+	/* A readin is alpha layers of k sub-chunks.  With packets, every
+	   sub-chunk must hold whole groups of w packets; without, a readin
+	   must be a multiple of k w-words as well as of alpha*k */
 	if (packetsize != 0) {
-		if (size%(k*w*packetsize*sizeof(long)) != 0) {
-			while (newsize%(k*w*packetsize*sizeof(long)) != 0) 
-				newsize++;
-		}
+		unit = (long long)alpha*k*w*packetsize*sizeof(long);
 	}
 	else {
-		if (size%(k*w*sizeof(long)) != 0) {
-			while (newsize%(k*w*sizeof(long)) != 0) 
-				newsize++;
-		}
-	}
-	
-	if (buffersize != 0) {
-		while (newsize%buffersize != 0) {
-			newsize++;
-		}
+		unit = (long long)k*w*sizeof(long) / gcd(k*w*sizeof(long), (long long)alpha*k) * alpha*k;
 	}
+	newsize = (size > 0) ? (size + unit - 1) / unit * unit : unit;
 
+	/* Readins of buffersize bytes, the valid size nearest the argument;
+	   0 streams DEFAULT_STRIPE_BYTES at a time.  Files that fit in one
+	   readin are encoded in one, padded only to the next unit. */
+	if (buffersize == 0) {
+		buffersize = DEFAULT_STRIPE_BYTES / unit * unit;
+	}
+	else {
+		buffersize = (buffersize + unit/2) / unit * unit;
+	}
+	if (buffersize < unit) {
+		buffersize = unit;
+	}
+	if (buffersize > newsize) {
+		buffersize = newsize;
+	}
+	newsize = (newsize + buffersize - 1) / buffersize * buffersize;
+	readins = newsize / buffersize;
 
 	/*if ((size % M) != 0) {
 	while ((newsize % M) != 0)
@@ -457,30 +839,16 @@ int main (int argc, char **argv) {
 
 
 	/* Determine size of k+m files */
-	stripe_size=newsize/M;
+	stripe_size = buffersize/alpha;
 	blocksize = stripe_size/k;
-	
-	
-	/* Allow for buffersize and determine number of read-ins */
-	if (size > buffersize && buffersize != 0) {
-		if (newsize%buffersize != 0) {
-			readins = newsize/buffersize;
-		}
-		else {
-			readins = newsize/buffersize;
-		}
-		block = (char *)malloc(sizeof(char)*buffersize);
-		blocksize = buffersize/k;
+	if (blocksize != stripe_size/k) {
+		fprintf(stderr, "buffersize %lld is too large for %d layers.\n", buffersize, alpha);
+		exit(0);
 	}
-	else {
-		readins = 1;
-		buffersize = size;
-		block = (char *)malloc(sizeof(char)*newsize);
-	}
-	printf("buffersize:%d\n", buffersize);
-	printf("size:%d\n", size);
-        printf("newsize:%d\n",newsize);
-	printf("stripe_size:%d\n",stripe_size);	
+	printf("buffersize:%lld\n", buffersize);
+	printf("size:%lld\n", size);
+        printf("newsize:%lld\n",newsize);
+	printf("stripe_size:%lld\n",stripe_size);	
 	printf("blocksize:%d\n", blocksize);
 	/* Break inputfile name into the filename and extension */	
 	s1 = (char*)malloc(sizeof(char)*(strlen(argv[1])+20));
@@ -505,24 +873,9 @@ int main (int argc, char **argv) {
 	sprintf(temp, "%d", k);
 	md = strlen(temp);
 	
-	/* Allocate data and coding */
-	data = (char **)malloc(sizeof(char*)*k);
-	coding = (char **)malloc(sizeof(char*)*m);
-	for (i = 0; i < m; i++) {
-		coding[i] = (char *)malloc(sizeof(char)*blocksize);
-                if (coding[i] == NULL) { perror("malloc"); exit(1); }
-	}
-
-	fdata = (char **)malloc(sizeof(char*)*M);
-	fcoding = (char **)malloc(sizeof(char*)*M);
 	//ccoding = (char **)malloc(sizeof(char*)*M*m);
 	//datacopy1 =  (char *)malloc(sizeof(char)*blocksize);
 	//datacopy2 =  (char *)malloc(sizeof(char)*blocksize);
-        extra1 = (char *)malloc(sizeof(char)*blocksize);
-	extra2 = (char *)malloc(sizeof(char)*blocksize);
-        extra = (char **)malloc(sizeof(char*)*128);
-		for(i=0;i<128;i++)
-		{extra[i] = (char *)malloc(sizeof(char)*blocksize);}
 	//printf("coding[0]:%p\n",&coding[0]);
        
 	/*A1 =  (char *)malloc(sizeof(char));
@@ -549,6 +902,9 @@ int main (int argc, char **argv) {
 			break;
 		case Reed_Sol_Van:
 			matrix = reed_sol_vandermonde_coding_matrix(k, m, w);
+			if (w == 8) {
+				dot_tables = galois_w08_dot_prod_init(k, m, matrix);
+			}
 			break;
 		case Reed_Sol_R6_Op:
 			break;
@@ -578,6 +934,84 @@ int main (int argc, char **argv) {
 		case EVENODD:
 			assert(0);
 	}
+
+	/* The cauchy codes work on w-packet groups, so couple in the same
+	   layout with XOR schedules; otherwise sub-chunks are GF(2^8) bytes */
+	if (tech == Cauchy_Orig || tech == Cauchy_Good) {
+		coupler = clay_coupler_new(r, w, packetsize);
+	}
+	else {
+		coupler = clay_coupler_new(r, 8, 0);
+	}
+	if (coupler == NULL) {
+		fprintf(stderr, "Unable to set up coupling for w=%d packetsize=%d.\n", w, packetsize);
+		exit(0);
+	}
+	if (clay_coupler_check(coupler, blocksize) < 0) {
+		fprintf(stderr, "Sub-chunks of %d bytes are not whole w*packetsize groups.\n", blocksize);
+		exit(0);
+	}
+	/* CLAY_NT_STORES=1 writes the coupled sub-chunks with non-temporal
+	   stores; see clay-bench for whether that pays off on a machine */
+	if (getenv("CLAY_NT_STORES") != NULL && strcmp(getenv("CLAY_NT_STORES"), "1") == 0) {
+		coupler->nt = 1;
+	}
+	/* CLAY_TILE=bytes encodes in byte-column tiles of about that width,
+	   rounded down to whole w-word (or w-packet) groups; a good width keeps
+	   alpha*(k+m)*tile bytes within L2.  Unset, or as wide as a
+	   sub-chunk, encodes whole sub-chunks. */
+	tile = 0;
+	if (getenv("CLAY_TILE") != NULL) {
+		i = (packetsize != 0) ? w*packetsize : w*(int)sizeof(long);
+		tile = atoi(getenv("CLAY_TILE")) / i * i;
+		if (tile <= 0 || tile >= blocksize) {
+			tile = 0;
+		}
+	}
+	/* --systematic encodes by decoding the parity nodes as erasures.
+	   Its layers depend on each other, so it always runs in tiles: one
+	   per thread unless CLAY_TILE asks for smaller ones. */
+	job.sys = NULL;
+	if (systematic) {
+		erased = (int *)malloc(sizeof(int)*(k+m));
+		assert(erased != NULL);
+		for (i = 0; i < k+m; i++) {
+			erased[i] = (i >= k);
+		}
+		job.sys = clay_code_decode_plan(code, erased, NULL);
+		free(erased);
+		if (job.sys == NULL) {
+			fprintf(stderr, "Unable to plan the systematic encode.\n");
+			exit(0);
+		}
+		if (tile == 0) {
+			i = (packetsize != 0) ? w*packetsize : w*(int)sizeof(long);
+			tile = ((blocksize + threads - 1) / threads + i - 1) / i * i;
+		}
+	}
+
+	pool = clay_pool_new(threads);
+	if (pool == NULL) {
+		fprintf(stderr, "Unable to start %d threads.\n", threads);
+		exit(0);
+	}
+	job.tech = tech;
+	job.k = k;
+	job.m = m;
+	job.w = w;
+	job.packetsize = packetsize;
+	job.matrix = matrix;
+	job.dot_tables = dot_tables;
+	job.schedule = schedule;
+	job.blocksize = blocksize;
+	job.tile = tile;
+	job.code = code;
+	job.coupler = coupler;
+	job.deps = clay_deps_new(code->plan, alpha);
+	if (job.deps == NULL) {
+		fprintf(stderr, "Unable to allocate the coupling dependencies.\n");
+		exit(0);
+	}
 	timing_set(&start);
 	timing_set(&t4);
 	totalsec += timing_delta(&t3, &t4);
@@ -585,116 +1019,115 @@ int main (int argc, char **argv) {
 	jerasure_print_matrix(matrix,k+m,k,w);
 printf("\n");
 
-	/* Read in data until finished */
-	n = 1;
-	total = 0;
-
-	while (n <= readins) {
-		/* Check if padding is needed, if so, add appropriate 
-		   number of zeros */
-		if (total < size && total+buffersize <= size) {
-			total += jfread(block, sizeof(char), buffersize, fp);
+	/* The reader, the encoder (this thread and the pool) and one writer
+	   per node file run as a pipeline with CLAY_STRIPES readins in flight,
+	   3 by default: while one readin is encoded the next is read and the
+	   previous one written.  Each in flight holds its own arena.
+	   CLAY_HUGEPAGES=1 backs the arenas with huge pages. */
+	nstripes = 3;
+	if (getenv("CLAY_STRIPES") != NULL) {
+		nstripes = atoi(getenv("CLAY_STRIPES"));
+		if (nstripes < 1) {
+			nstripes = 1;
 		}
-		else if (total < size && total+buffersize > size) {
-			extra3 = jfread(block, sizeof(char), buffersize, fp);
-			for (i = extra3; i < buffersize; i++) {
-				block[i] = '0';
-			}
+	}
+	if (nstripes > readins) {
+		nstripes = readins;
+	}
+	stripes = (struct stripe *)malloc(sizeof(struct stripe)*nstripes);
+	free_stripes = clay_queue_new(nstripes);
+	reader.full = clay_queue_new(nstripes);
+	if (stripes == NULL || free_stripes == NULL || reader.full == NULL) {
+		fprintf(stderr, "Unable to allocate the stripe buffers.\n");
+		exit(0);
+	}
+	huge = (getenv("CLAY_HUGEPAGES") != NULL && strcmp(getenv("CLAY_HUGEPAGES"), "1") == 0);
+	/* The data part is what a readin reads, and the parities start on a
+	   cache line */
+	databytes = ((long)alpha*k*blocksize + 63) / 64 * 64;
+	for (i = 0; i < nstripes; i++) {
+		st = &stripes[i];
+		st->bytes = databytes + (long)alpha*m*blocksize;
+		st->block = stripe_arena_new(st->bytes, huge);
+		st->fdata = (char **)malloc(sizeof(char*)*alpha);
+		st->fcoding = (char **)malloc(sizeof(char*)*alpha);
+		st->iov = (struct iovec *)malloc(sizeof(struct iovec)*(k+m)*alpha);
+		st->index = i;
+		if (st->block == NULL || st->fdata == NULL || st->fcoding == NULL || st->iov == NULL) {
+			fprintf(stderr, "Unable to allocate the stripe buffers.\n");
+			exit(0);
+		}
+		for (j = 0; j < alpha; j++) {
+			st->fdata[j] = st->block + (long)j*k*blocksize;
+			st->fcoding[j] = st->block + databytes + (long)j*m*blocksize;
 		}
-		else if (total == size) {
-			for (i = 0; i < buffersize; i++) {
-				block[i] = '0';
+		clay_queue_push(free_stripes, st);
+	}
+
+	writer.nodes = NULL;
+	if (fp != NULL) {
+		writer.nnodes = k+m;
+		writer.nodes = (struct node_file *)malloc(sizeof(struct node_file)*(k+m));
+		assert(writer.nodes != NULL);
+		for (i = 0; i < k+m; i++) {
+			if (i < k) {
+				sprintf(fname, "%s/Coding/%s_k%0*d%s", curdir, s1, md, i, extension);
+			}
+			else {
+				sprintf(fname, "%s/Coding/%s_m%0*d%s", curdir, s1, md, i-k, extension);
+			}
+			writer.nodes[i].fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (writer.nodes[i].fd < 0) {
+				fprintf(stderr, "Unable to open %s.\n", fname);
+				exit(0);
 			}
+			writer.nodes[i].pos = 0;
+			writer.nodes[i].coding = (i >= k);
+			writer.nodes[i].off = ((i < k) ? i : i-k)*blocksize;
 		}
+		writer.alpha = alpha;
+		writer.blocksize = blocksize;
+		writer.depth = nstripes*(k+m);
+		writer.free = free_stripes;
+		writer.queue = clay_queue_new(nstripes + 1);
+		if (writer.queue == NULL || pthread_create(&writer.thread, NULL, write_stripes, &writer) != 0) {
+			fprintf(stderr, "Unable to start the writer.\n");
+			exit(0);
+		}
+	}
+	reader.fp = fp;
+	reader.size = size;
+	reader.buffersize = buffersize;
+	reader.free = free_stripes;
+	reader.stripes = stripes;
+	reader.nstripes = nstripes;
+	if (pthread_create(&reader.thread, NULL, read_stripes, &reader) != 0) {
+		fprintf(stderr, "Unable to start the reader.\n");
+		exit(0);
+	}
+
+	/* Encode the readins in order as the reader delivers them */
+	for (n = 1; n <= readins; n++) {
+		st = clay_queue_pop(reader.full);
+		fdata = st->fdata;
+		fcoding = st->fcoding;
 
 printf("clay-encoding: \n");
 timing_set(&t3);
 timing_set(&q5);
 timing_set(&q1);
-		for(j = 0; j < M; j++)
-	     {
-		fdata[j] = (char *)malloc(sizeof(char)*k*blocksize);
-		fcoding[j] = (char *)malloc(sizeof(char)*m*blocksize);
-		/* Set pointers to point to file data */
-		for (i = 0; i < k; i++) {
-		   data[i] = block+((j*k+i)*blocksize);}
-		
-
-              
-		
-		/* Encode according to coding method */
-		switch(tech) {	
-			case No_Coding:
-				break;
-			case Reed_Sol_Van:
-				jerasure_matrix_encode(k, m, w, matrix, data, coding, blocksize);
-				break;
-			case Reed_Sol_R6_Op:
-				reed_sol_r6_encode(k, w, data, coding, blocksize);
-				break;
-			case Cauchy_Orig:
-				jerasure_schedule_encode(k, m, w, schedule, data, coding, blocksize, packetsize);
-				break;
-			case Cauchy_Good:
-				jerasure_schedule_encode(k, m, w, schedule, data, coding, blocksize, packetsize);
-				break;
-			case Liberation:
-				jerasure_schedule_encode(k, m, w, schedule, data, coding, blocksize, packetsize);
-				break;
-			case Blaum_Roth:
-				jerasure_schedule_encode(k, m, w, schedule, data, coding, blocksize, packetsize);
-				break;
-			case Liber8tion:
-				jerasure_schedule_encode(k, m, w, schedule, data, coding, blocksize, packetsize);
-				break;
-			case RDP:
-			case EVENODD:
-				assert(0);
+		job.fdata = fdata;
+		job.fcoding = fcoding;
+		if (tile != 0) {
+			/* Tiles are independent: each couples its own columns */
+			clay_pool_run(pool, (blocksize + tile - 1) / tile, encode_tile_task, &job);
+		}
+		else {
+			/* One phase: a pair is coupled by whichever thread finishes
+			   the second of its two layers */
+			clay_deps_reset(job.deps);
+			clay_pool_run(pool, alpha, encode_layer_task, &job);
 		}
- 	        
- 
-			/* for(i1=0;i1<1;i1++){
-	                        for(j1=0;j1<blocksize;j1++)
-                                   {
-					printf("%d ",fcoding[i1][j1]);
-			           }
-				printf( " \n");
-				}*/
-	    
-                    //printf("Encoding Complete:\n\n");
-	           // print_data_and_coding(k, m, w, sizeof(long), data, coding);
-				
-				
-				//for (i=0;i<m*blocksize;i++)
-				//{fcoding[j][i]= *(coding[0]+i);}
-				
-
-		/*for(i=0;i<k;i++){
-                for(i1=0;i1<blocksize;i1++){
-                   fdata[j][i*blocksize+i1]=data[i][i1];}
-                }
-
-               for(i=0;i<m;i++){
-               for(i1=0;i1<blocksize;i1++){
-                   fcoding[j][i*blocksize+i1]=coding[i][i1];}
-               }	*/
-
-
-
-				
-				for(iii=0;iii<m;iii++){
-				for (i=0;i<blocksize;i++){
-				fcoding[j][i22]= *(coding[iii]+i);
-				i22++;}}
-				i22=0;
-				
-				 for(i=0;i<k*blocksize;i++)
-				  {
-				  fdata[j][i] = *(block+j*k*blocksize+i);}
-
-	   
-		
-	   }		
 timing_set(&q2);
 
 printf("encoder complete \n");		
@@ -1017,251 +1450,8 @@ printf( " original fdata n=8 :\n");
 
 				
 printf(" 0 \n\n");
-printf(" bit_operation_start:\n");		
- timing_set(&q3);       
-
-	 for(i=0;i<M;i++){	
-            if( i%2 == 0){////i =0,2,4,6,8,10,12,14,16,18,20,22,24,26,28,30,32,34,36,38,40,42,46,48,56,64,72,74,76,78,80,82,84,86,88,90,92,94,96,98,100,102,104,106,108,110,112,114,116,118,120,122,124,126
-/*printf( " value=extra1:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0] +blocksize+ i1));}
-printf( " \n");	     
-printf( " value=extra2:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0+1] + i1));}
-printf( " \n");	*/
-		for (i1=0;i1<blocksize;i1++){
-			extra1[i1]=*(fdata[i] +blocksize+ i1);
-			extra2[i1]=*(fdata[i+1] + i1);}
-/*printf( " extra1:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",extra1[i1]);}
-printf( " \n");
-printf( " extra2:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",extra2[i1]);}
-printf( " \n");
-
-
-                
-printf( " 1 before first times1   *r:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0] + blocksize+i1));}
-printf( " \n");*/
-
-
-		galois_w08_region_multiply((fdata[i] + blocksize), r, blocksize, fdata[i+1], 0);
-	
-
-/*printf( " 2 after first times1 *r:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0+1] +i1));}
-printf( " \n");
-
-printf( " 3--extra2value  before second times2   *r:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(extra2+i1));}
-printf( " \n");*/
-
-
-		galois_w08_region_multiply(extra2 , r, blocksize, (fdata[i] + blocksize), 0);
-
-
-/*printf( " 4 afte second times2  * r:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0] + blocksize+i1));}
-printf( " \n");	
-
-
-
-printf( " 5--extra1value  before XOR1   extra1 XOR 4:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(extra1+i1));}
-printf( " \n");*/
-
-		galois_w8_region_xor(extra1, (fdata[i] + blocksize),blocksize);
-/*printf( " 6 after XOR1  compare 4:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0] + blocksize+i1));}
-printf( " \n");
-
-printf( " 7 before XOR2:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0+1]+i1));}
-printf( " \n");
-
-printf( " 9--extra2value    XOR 7:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(extra2+i1));}
-printf( " \n");*/
-		galois_w8_region_xor(extra2, (fdata[i+1]), blocksize);
-
-/*printf( " 8 after XOR2  compare 7:\n");
-for(i1 = 0; i1< blocksize; i1++) {
-printf("%d ",*(fdata[0+1]+i1));}
-printf( " \n");	*/		
-}}
-
-
-
-
-       for(i=0;i<M;i++){
-	   if( i%4 == 0 ){
-               // save original value		
-		for(j=0;j<2;j++){
-		for (i1=0;i1<blocksize;i1++){
-		extra[j][i1]= *(fdata[i+j]+3*blocksize+i1);}}                   
-		    for(j=2;j<4;j++){
-		    for (i1=0;i1<blocksize;i1++){
-                extra[j][i1] = *(fdata[i+j]+2*blocksize+i1);}}
-
- 		    for(j=0;j<2;j++){
-		galois_w08_region_multiply((fdata[i+j]+3*blocksize), r, blocksize, (fdata[i+j+2]+2*blocksize), 0);}
-		
-		    for(j=2;j<4;j++){
-	
-	        galois_w08_region_multiply(extra[j], r, blocksize, (fdata[i+j-2]+3*blocksize), 0);}
-
-		    for(j=0;j<2;j++){
-                 
-		galois_w8_region_xor((extra[j]), (fdata[i+j]  + 3*blocksize),blocksize);}
-		
-		    for(j=2;j<4;j++){
-	
-		 galois_w8_region_xor(extra[j], (fdata[i+j]  + 2*blocksize),blocksize);}}}
-		
-
-
-printf(" 1 \n\n");
-	for(i=0;i<M;i++){
-	 if( i%8 == 0 ){//i = 0,8,16,32,40,48,56,64,72,80,88,96,104,112,120
-		int t4=8;
-     
-
-                for(j=0;j<t4/2;j++){
-		for (i1=0;i1<blocksize;i1++){
-		extra[j][i1]= *(fdata[i+j]+5*blocksize+i1);}}                   
-		    for(j=t4/2;j<t4;j++){
-		    for (i1=0;i1<blocksize;i1++){
-                extra[j][i1] = *(fdata[i+j]+4*blocksize+i1);}}
-
-
- 		    for(j=0;j<t4/2;j++){
-		galois_w08_region_multiply((fdata[i+j]+5*blocksize), r, blocksize, (fdata[i+j+t4/2]+4*blocksize), 0);}
-		
-		    for(j=t4/2;j<t4;j++){
-		galois_w08_region_multiply(extra[j], r, blocksize, (fdata[i+j-t4/2]+5*blocksize), 0);}
-
-		    for(j=0;j<t4/2;j++){
-		
-		galois_w8_region_xor(extra[j], (fdata[i+j]  + 5*blocksize),blocksize);}
-		    for(j=t4/2;j<t4;j++){
-		
-		galois_w8_region_xor(extra[j], (fdata[i+j]  + 4*blocksize),blocksize);}}}
-printf(" 2 \n\n");	
-	for(i=0;i<M;i++){
-         if( i%16 == 0 ){//i=0,16,32,48,64,80,96,112
-		int t3=16;
-             
-
-		for(j=0;j<t3/2;j++){
-		for (i1=0;i1<blocksize;i1++){
-		extra[j][i1]= *(fdata[i+j]+7*blocksize+i1);}}                   
-		    for(j=t3/2;j<t3;j++){
-		    for (i1=0;i1<blocksize;i1++){
-                extra[j][i1] = *(fdata[i+j]+6*blocksize+i1);}}
-
- 		    for(j=0;j<t3/2;j++){
-		galois_w08_region_multiply((fdata[i+j]+7*blocksize), r, blocksize, (fdata[i+j+t3/2]+6*blocksize), 0);}
-		
-		    for(j=t3/2;j<t3;j++){
-		galois_w08_region_multiply(extra[j], r, blocksize, (fdata[i+j-t3/2]+7*blocksize), 0);}
-
-		    for(j=0;j<t3/2;j++){
-	
-		galois_w8_region_xor(extra[j], (fdata[i+j]  + 7*blocksize),blocksize);}
-		    for(j=t3/2;j<t3;j++){
-		
-		galois_w8_region_xor(extra[j], (fdata[i+j]  + 6*blocksize),blocksize);}}}
-printf(" 3\n\n");
-	for(i=0;i<M;i++){
-         if( i%32 == 0 ){//i = 0,32 ,64,96
-		int t2=32;
-              
-
-		for(j=0;j<t2/2;j++){
-		for (i1=0;i1<blocksize;i1++){
-		extra[j][i1]= *(fdata[i+j]+9*blocksize+i1);}}                   
-		    for(j=t2/2;j<t2;j++){
-		    for (i1=0;i1<blocksize;i1++){
-                extra[j][i1] = *(fdata[i+j]+8*blocksize+i1);}}
-
- 		    for(j=0;j<t2/2;j++){
-		galois_w08_region_multiply((fdata[i+j]+9*blocksize), r, blocksize, (fdata[i+j+t2/2]+8*blocksize), 0);}
-		
-		    for(j=t2/2;j<t2;j++){
-		galois_w08_region_multiply(extra[j], r, blocksize, (fdata[i+j-t2/2]+9*blocksize), 0);}
-
-		    for(j=0;j<t2/2;j++){
-	
-		galois_w8_region_xor(extra[j], (fdata[i+j]  + 9*blocksize),blocksize);}
-		    for(j=t2/2;j<t2;j++){
-
-		galois_w8_region_xor(extra[j], (fdata[i+j]  + 8*blocksize),blocksize);}}}
-printf(" 4 \n\n");
-     for(i=0;i<M;i++){
-       if( i%64 == 0 ){//i=0 ,64
-		int t1=64;
-		for(j=0;j<t1/2;j++){
-		for (i1=0;i1<blocksize;i1++){
-		extra[j][i1]= *(fcoding[i+j]+blocksize+i1);}}                   
-		    for(j=t1/2;j<t1;j++){
-		    for (i1=0;i1<blocksize;i1++){
-                extra[j][i1] = *(fcoding[i+j]+i1);}}
-
-
- 		    for(j=0;j<t1/2;j++){
-		galois_w08_region_multiply((fcoding[i+j]+blocksize), r, blocksize, (fcoding[i+j+t1/2]), 0);}
-		
-		    for(j=t1/2;j<t1;j++){
-		galois_w08_region_multiply(extra[j], r, blocksize, (fcoding[i+j-t1/2]+blocksize), 0);}
-
-		    for(j=0;j<t1/2;j++){
-	
-		galois_w8_region_xor(extra[j], (fcoding[i+j]  + blocksize),blocksize);}
-		    for(j=t1/2;j<t1;j++){
-	
-		galois_w8_region_xor(extra[j], fcoding[i+j]  ,blocksize);}}}
-printf(" 5 \n\n");
-  for(i=0;i<M;i++){
-    if( i%128 == 0 ){//i=0
-		int t=128;
-              for(j=0;j<t/2;j++){
-		for (i1=0;i1<blocksize;i1++){
-		extra[j][i1]= *(fcoding[i+j]+3*blocksize+i1);}}                   
-		    for(j=t/2;j<t;j++){
-		    for (i1=0;i1<blocksize;i1++){
-                extra[j][i1] = *(fcoding[i+j]+2*blocksize+i1);}}
-
-
- 		    for(j=0;j<t/2;j++){
-		galois_w08_region_multiply((fcoding[i+j]+3*blocksize), r, blocksize, (fcoding[i+j+t/2]+2*blocksize), 0);}
-		
-		    for(j=t/2;j<t;j++){
-		galois_w08_region_multiply(extra[j], r, blocksize, (fcoding[i+j-t/2]+3*blocksize), 0);}
-
-		    for(j=0;j<t/2;j++){
-
-		  galois_w8_region_xor((extra[j]), (fcoding[i+j]  + 3*blocksize),blocksize);}
-		    for(j=t/2;j<t;j++){
-	
-		galois_w8_region_xor((extra[j]), (fcoding[i+j]  + 2*blocksize),blocksize);}}}
-printf(" 6 \n\n");
-     
-timing_set(&q4);
 timing_set(&q6);
 timing_set(&t4);
-printf("bit operation ended \n");
 						//}
 	    /*  printf( " after operation fcoding first strip  :\n");
 	  		
@@ -1294,63 +1484,54 @@ printf( " after operation fdata first strip  :\n");
 
 
 
-		/* Write data and encoded data to k+m files */
-		for	(i = 0; i < k; i++) {
-		 
-			if (fp == NULL) {
-				bzero(fdata[i], blocksize);
- 			} else {
-				sprintf(fname, "%s/Coding/%s_k%0*d%s", curdir, s1, md, i, extension);
-				if (n == 1) {
-					fp2 = fopen(fname, "wb");
-				}
-				else {
-				
-				fp2 = fopen(fname, "ab");
-				}
-				for(j=0;j<M;j++){
-				fwrite(&fdata[j][(i)*blocksize], sizeof(char), blocksize, fp2);}
-				
-				fclose(fp2);
-			}
-			
+		/* Hand the stripe to the writer, which gives it back to the
+		   reader once it is on disk */
+		if (writer.nodes == NULL) {
+			clay_queue_push(free_stripes, st);
 		}
-             //printf(" outComplete33\n\n");
-		for	(i = 0; i < m; i++) {
-			if (fp == NULL) {
-				bzero(fdata[i], blocksize);
- 			} else {
-				sprintf(fname, "%s/Coding/%s_m%0*d%s", curdir, s1, md, i, extension);
-				//if (n == 1) {
-				//	fp2 = fopen(fname, "wb");
-				//}
-				//else {
-					fp2 = fopen(fname, "ab");
-				//}
-				for(j=0;j<M;j++){
-				fwrite(&fcoding[j][(i)*blocksize], sizeof(char), blocksize, fp2);}
-				fclose(fp2);
-			}
+		else {
+			clay_queue_push(writer.queue, st);
 		}
-		n++;
 		/* Calculate encoding time */
 
 		totalsec += timing_delta(&t3, &t4);
 		encode_time= timing_delta(&q1, &q2);
-		bit_operation_time= timing_delta(&q3, &q4);
 		sum_time= timing_delta(&q5, &q6);
 	}
 
+	/* Drain the pipeline */
+	pthread_join(reader.thread, NULL);
+	if (writer.nodes != NULL) {
+		clay_queue_push(writer.queue, NULL);
+		pthread_join(writer.thread, NULL);
+		clay_queue_free(writer.queue);
+		for (i = 0; i < k+m; i++) {
+			close(writer.nodes[i].fd);
+		}
+		free(writer.nodes);
+	}
+	for (i = 0; i < nstripes; i++) {
+		free(stripes[i].fdata);
+		free(stripes[i].fcoding);
+		free(stripes[i].iov);
+		free(stripes[i].block);
+	}
+	free(stripes);
+	clay_queue_free(free_stripes);
+	clay_queue_free(reader.full);
+
 	/* Create metadata file */
         if (fp != NULL) {
 		sprintf(fname, "%s/Coding/%s_meta.txt", curdir, s1);
 		fp2 = fopen(fname, "wb");
 		fprintf(fp2, "%s\n", argv[1]);
-		fprintf(fp2, "%d\n", size);
-		fprintf(fp2, "%d %d %d %d %d\n", k, m, w, packetsize, buffersize);
+		fprintf(fp2, "%lld\n", size);
+		fprintf(fp2, "%d %d %d %d %lld\n", k, m, w, packetsize, buffersize);
 		fprintf(fp2, "%s\n", argv[4]);
 		fprintf(fp2, "%d\n", tech);
 		fprintf(fp2, "%d\n", readins);
+		fprintf(fp2, "%d\n", d);
+		fprintf(fp2, "%d\n", systematic);
 		fclose(fp2);
 	}
 
@@ -1358,8 +1539,13 @@ printf( " after operation fdata first strip  :\n");
 	/* Free allocated memory */
 	free(s1);
 	free(fname);
-	free(block);
 	free(curdir);
+	free(dot_tables);
+	clay_coupler_free(coupler);
+	clay_code_free(code);
+	clay_pool_free(pool);
+	clay_deps_free(job.deps);
+	clay_decode_plan_free(job.sys);
 	
 	/* Calculate rate in MB/sec and print */
 	timing_set(&t2);
@@ -1367,7 +1553,6 @@ printf( " after operation fdata first strip  :\n");
 	printf("Encoding (MB/sec): %0.10f\n", (((double) size)/1024.0/1024.0)/totalsec);
 	printf("En_Total (MB/sec): %0.10f\n", (((double) size)/1024.0/1024.0)/tsec);
 	printf("encode_time (sec): %0.10f\n", encode_time);
-	printf("bit_operation_time (sec): %0.10f\n", bit_operation_time);
 	printf("sum_time (sec): %0.10f\n", sum_time);
 	return 0;
 }
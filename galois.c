@@ -49,12 +49,22 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "galois.h"
+#include "galois_ext.h"
+#include "gf8.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GALOIS_X86_DISPATCH
+#include <immintrin.h>
+#endif
 
 #define MAX_GF_INSTANCES 64
 gf_t *gfp_array[MAX_GF_INSTANCES] = { 0 };
 int  gfp_is_composite[MAX_GF_INSTANCES] = { 0 };
+int  gfp_is_default[MAX_GF_INSTANCES] = { 0 };
 
 gf_t *galois_get_field_ptr(int w)
 {
@@ -170,16 +180,36 @@ gf_t* galois_init_composite_field(int w,
   return gfp;
 }
 
+/* Default fields are built on first use, possibly by several coding
+   threads at once.  Building is serialized by galois_init_lock, and the
+   field pointer is only published once the field is complete, so a reader
+   that sees it non-NULL can use it without taking the lock.  Installing or
+   freeing fields (galois_change_technique, galois_uninit_field) is not
+   synchronized and must happen before coding threads start. */
+
+static pthread_mutex_t galois_init_lock = PTHREAD_MUTEX_INITIALIZER;
+
 int galois_init_default_field(int w)
 {
+  gf_t *gfp;
+  int ret;
+
+  ret = 0;
+  pthread_mutex_lock(&galois_init_lock);
   if (gfp_array[w] == NULL) {
-    gfp_array[w] = (gf_t*)malloc(sizeof(gf_t));
-    if(gfp_array[w] == NULL)
-      return ENOMEM;
-    if (!gf_init_easy(gfp_array[w], w))
-      return EINVAL;
+    gfp = (gf_t*)malloc(sizeof(gf_t));
+    if (gfp == NULL) {
+      ret = ENOMEM;
+    } else if (!gf_init_easy(gfp, w)) {
+      free(gfp);
+      ret = EINVAL;
+    } else {
+      gfp_is_default[w] = 1;
+      __atomic_store_n(&gfp_array[w], gfp, __ATOMIC_RELEASE);
+    }
   }
-  return 0;
+  pthread_mutex_unlock(&galois_init_lock);
+  return ret;
 }
 
 int galois_uninit_field(int w)
@@ -190,6 +220,7 @@ int galois_uninit_field(int w)
     ret = gf_free(gfp_array[w], recursive);
     free(gfp_array[w]);
     gfp_array[w] = NULL;
+    gfp_is_default[w] = 0;
   }
   return ret;
 }
@@ -214,6 +245,21 @@ static void galois_init(int w)
 }
 
 
+/* The field for w, built if need be.  The acquire load pairs with the
+   release store in galois_init_default_field(). */
+
+static gf_t *galois_field(int w)
+{
+  gf_t *gfp;
+
+  gfp = __atomic_load_n(&gfp_array[w], __ATOMIC_ACQUIRE);
+  if (gfp == NULL) {
+    galois_init(w);
+    gfp = __atomic_load_n(&gfp_array[w], __ATOMIC_ACQUIRE);
+  }
+  return gfp;
+}
+
 static int is_valid_gf(gf_t *gf, int w)
 {
   // TODO: I assume we may eventually
@@ -260,18 +306,31 @@ void galois_change_technique(gf_t *gf, int w)
   }
 
   gfp_array[w] = gf;
+  gfp_is_default[w] = 0;
+}
+
+/* The default w=8 field is GF(2^8) mod 0x11d, which gf8.h tabulates, so
+   single-word w=8 arithmetic does not need the field to be built. */
+
+#define GALOIS_W08_DEFAULT() \
+  (__atomic_load_n(&gfp_array[8], __ATOMIC_ACQUIRE) == NULL || gfp_is_default[8])
+
+int galois_w08_is_default(void)
+{
+  return GALOIS_W08_DEFAULT();
 }
 
 int galois_single_multiply(int x, int y, int w)
 {
   if (x == 0 || y == 0) return 0;
-  
-  if (gfp_array[w] == NULL) {
-    galois_init(w);
-  }
 
+  if (w == 8 && GALOIS_W08_DEFAULT()) {
+    return gf8_mul((uint8_t) x, (uint8_t) y);
+  }
+  
   if (w <= 32) {
-    return gfp_array[w]->multiply.w32(gfp_array[w], x, y);
+    gf_t *gfp = galois_field(w);
+    return gfp->multiply.w32(gfp, x, y);
   } else {
     fprintf(stderr, "ERROR -- Galois field not implemented for w=%d\n", w);
     return 0;
@@ -283,28 +342,531 @@ int galois_single_divide(int x, int y, int w)
   if (x == 0) return 0;
   if (y == 0) return -1;
 
-  if (gfp_array[w] == NULL) {
-    galois_init(w);
+  if (w == 8 && GALOIS_W08_DEFAULT()) {
+    return gf8_div((uint8_t) x, (uint8_t) y);
   }
 
   if (w <= 32) {
-    return gfp_array[w]->divide.w32(gfp_array[w], x, y);
+    gf_t *gfp = galois_field(w);
+    return gfp->divide.w32(gfp, x, y);
   } else {
     fprintf(stderr, "ERROR -- Galois field not implemented for w=%d\n", w);
     return 0;
   }
 }
 
+/* SIMD tier selection.  The tier is read from cpuid the first time a
+   region routine runs; GALOIS_SIMD=none|ssse3|avx2|avx512|gfni in the
+   environment caps it, which is how the tiers are benchmarked against each
+   other on one machine. */
+
+static int galois_simd = GALOIS_SIMD_NONE;
+static pthread_once_t galois_simd_once = PTHREAD_ONCE_INIT;
+
+static void galois_simd_detect(void)
+{
+  static const char *names[] = { "none", "ssse3", "avx2", "avx512", "gfni" };
+  char *cap;
+  int level;
+  int i;
+
+  level = GALOIS_SIMD_NONE;
+#ifdef GALOIS_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) level = GALOIS_SIMD_SSSE3;
+  if (__builtin_cpu_supports("avx2")) level = GALOIS_SIMD_AVX2;
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    level = GALOIS_SIMD_AVX512;
+    if (__builtin_cpu_supports("gfni")) level = GALOIS_SIMD_GFNI;
+  }
+#endif
+  cap = getenv("GALOIS_SIMD");
+  if (cap != NULL) {
+    for (i = 0; i <= GALOIS_SIMD_GFNI; i++) {
+      if (strcmp(cap, names[i]) == 0 && i < level) level = i;
+    }
+  }
+  galois_simd = level;
+}
+
+int galois_simd_level(void)
+{
+  pthread_once(&galois_simd_once, galois_simd_detect);
+  return galois_simd;
+}
+
+/* Tables for multiplying w=8 regions by one constant c.  For a byte
+   x = (h << 4) | l,  c * x = lo[l] ^ hi[h].  affine is the 8x8 GF(2)
+   matrix of x -> c * x in the layout GF2P8AFFINEQB expects: byte 7-i of
+   the quadword is the row that produces bit i of the product. */
+
+static uint8_t galois_w08_product(int x, int multby, int dflt)
+{
+  return dflt ? gf8_mul((uint8_t) x, (uint8_t) multby) : (uint8_t) galois_single_multiply(x, multby, 8);
+}
+
+static void galois_w08_tables_fill(galois_w08_tables *t, int multby, int dflt)
+{
+  uint8_t col[8];
+  uint8_t row;
+  int i, j;
+
+  for (i = 0; i < 16; i++) {
+    t->lo[i] = galois_w08_product(i, multby, dflt);
+    t->hi[i] = galois_w08_product(i << 4, multby, dflt);
+  }
+  for (j = 0; j < 8; j++) {
+    col[j] = galois_w08_product(1 << j, multby, dflt);
+  }
+  t->affine = 0;
+  for (i = 0; i < 8; i++) {
+    row = 0;
+    for (j = 0; j < 8; j++) row |= ((col[j] >> i) & 1) << j;
+    t->affine |= (uint64_t) row << (8 * (7 - i));
+  }
+}
+
+void galois_w08_tables_init(galois_w08_tables *t, int multby)
+{
+  galois_w08_tables_fill(t, multby, 0);
+}
+
+/* The default w=8 context holds the tables for every constant of
+   GF(2^8) mod 0x11d.  It is built once, never changes afterwards and is
+   never freed, so any number of threads may use it without locking. */
+
+static galois_w08_ctx galois_w08_default;
+static pthread_once_t galois_w08_default_once = PTHREAD_ONCE_INIT;
+
+static void galois_w08_default_build(void)
+{
+  int c;
+
+  for (c = 0; c < 256; c++) galois_w08_tables_fill(&galois_w08_default.mul[c], c, 1);
+}
+
+const galois_w08_ctx *galois_w08_ctx_default(void)
+{
+  pthread_once(&galois_w08_default_once, galois_w08_default_build);
+  return &galois_w08_default;
+}
+
+#ifdef GALOIS_X86_DISPATCH
+__attribute__((target("ssse3")))
+static int galois_w08_mul_ssse3(uint8_t *src, uint8_t *dest, const galois_w08_tables *t,
+                                int nbytes, int add)
+{
+  __m128i tlo, thi, mask, x, p;
+  int i;
+
+  tlo = _mm_loadu_si128((__m128i *) t->lo);
+  thi = _mm_loadu_si128((__m128i *) t->hi);
+  mask = _mm_set1_epi8(0x0f);
+  for (i = 0; i + 16 <= nbytes; i += 16) {
+    x = _mm_loadu_si128((__m128i *) (src + i));
+    p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(x, mask)),
+                      _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+    if (add) p = _mm_xor_si128(p, _mm_loadu_si128((__m128i *) (dest + i)));
+    _mm_storeu_si128((__m128i *) (dest + i), p);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static int galois_w08_mul_avx2(uint8_t *src, uint8_t *dest, const galois_w08_tables *t,
+                               int nbytes, int add)
+{
+  __m256i tlo, thi, mask, x, p;
+  int i;
+
+  tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) t->lo));
+  thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) t->hi));
+  mask = _mm256_set1_epi8(0x0f);
+  for (i = 0; i + 32 <= nbytes; i += 32) {
+    x = _mm256_loadu_si256((__m256i *) (src + i));
+    p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask)),
+                         _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+    if (add) p = _mm256_xor_si256(p, _mm256_loadu_si256((__m256i *) (dest + i)));
+    _mm256_storeu_si256((__m256i *) (dest + i), p);
+  }
+  return i;
+}
+
+__attribute__((target("avx512f,avx512bw,gfni")))
+static int galois_w08_mul_gfni(uint8_t *src, uint8_t *dest, const galois_w08_tables *t,
+                               int nbytes, int add)
+{
+  __m512i a, x, p;
+  int i;
+
+  a = _mm512_set1_epi64((long long) t->affine);
+  for (i = 0; i + 64 <= nbytes; i += 64) {
+    x = _mm512_loadu_si512((void *) (src + i));
+    p = _mm512_gf2p8affine_epi64_epi8(x, a, 0);
+    if (add) p = _mm512_xor_si512(p, _mm512_loadu_si512((void *) (dest + i)));
+    _mm512_storeu_si512((void *) (dest + i), p);
+  }
+  return i;
+}
+
+/* Streaming-store versions for outputs that are not read again soon.
+   dest must be 32-byte aligned for AVX2 and 64-byte aligned for GFNI. */
+
+__attribute__((target("avx2")))
+static int galois_w08_mul_avx2_nt(uint8_t *src, uint8_t *dest, const galois_w08_tables *t,
+                                  int nbytes, int add)
+{
+  __m256i tlo, thi, mask, x, p;
+  int i;
+
+  tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) t->lo));
+  thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) t->hi));
+  mask = _mm256_set1_epi8(0x0f);
+  for (i = 0; i + 32 <= nbytes; i += 32) {
+    x = _mm256_loadu_si256((__m256i *) (src + i));
+    p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask)),
+                         _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+    if (add) p = _mm256_xor_si256(p, _mm256_load_si256((__m256i *) (dest + i)));
+    _mm256_stream_si256((__m256i *) (dest + i), p);
+  }
+  return i;
+}
+
+__attribute__((target("avx512f,avx512bw,gfni")))
+static int galois_w08_mul_gfni_nt(uint8_t *src, uint8_t *dest, const galois_w08_tables *t,
+                                  int nbytes, int add)
+{
+  __m512i a, x, p;
+  int i;
+
+  a = _mm512_set1_epi64((long long) t->affine);
+  for (i = 0; i + 64 <= nbytes; i += 64) {
+    x = _mm512_loadu_si512((void *) (src + i));
+    p = _mm512_gf2p8affine_epi64_epi8(x, a, 0);
+    if (add) p = _mm512_xor_si512(p, _mm512_load_si512((void *) (dest + i)));
+    _mm512_stream_si512((void *) (dest + i), p);
+  }
+  return i;
+}
+#endif
+
+/* dest = c * src, or dest ^= c * src when add is set, using the best tier
+   for the bulk and the nibble tables for the tail. */
+
+static void galois_w08_mul_region(uint8_t *src, uint8_t *dest, const galois_w08_tables *t,
+                                  int nbytes, int add)
+{
+  int i;
+  uint8_t p;
+
+  i = 0;
+#ifdef GALOIS_X86_DISPATCH
+  switch (galois_simd_level()) {
+  case GALOIS_SIMD_GFNI:
+    i = galois_w08_mul_gfni(src, dest, t, nbytes, add);
+    break;
+  case GALOIS_SIMD_AVX512:
+  case GALOIS_SIMD_AVX2:
+    i = galois_w08_mul_avx2(src, dest, t, nbytes, add);
+    break;
+  case GALOIS_SIMD_SSSE3:
+    i = galois_w08_mul_ssse3(src, dest, t, nbytes, add);
+    break;
+  }
+#endif
+  for (; i < nbytes; i++) {
+    p = t->lo[src[i] & 0x0f] ^ t->hi[src[i] >> 4];
+    dest[i] = add ? (dest[i] ^ p) : p;
+  }
+}
+
+/* Region multiply against an explicit context.  Nothing here touches the
+   global field state, so callers on different threads only share the
+   (read-only) context. */
+
+void galois_w08_ctx_region_multiply(const galois_w08_ctx *ctx, char *region, int multby,
+                                    int nbytes, char *r2, int add)
+{
+  char *dest;
+
+  dest = (r2 == NULL) ? region : r2;
+  if (r2 == NULL) add = 0;
+  multby &= 0xff;
+
+  if (multby == 0) {
+    if (!add) memset(dest, 0, nbytes);
+    return;
+  }
+  if (multby == 1) {
+    if (add) {
+      galois_region_xor(region, dest, nbytes);
+    } else if (dest != region) {
+      memcpy(dest, region, nbytes);
+    }
+    return;
+  }
+  galois_w08_mul_region((uint8_t *) region, (uint8_t *) dest, &ctx->mul[multby], nbytes, add);
+}
+
+/* Dividing a region by a constant is a multiply by its inverse, found
+   once up front. */
+
+void galois_w08_ctx_region_divide(const galois_w08_ctx *ctx, char *region, int divby,
+                                  int nbytes, char *r2, int add)
+{
+  galois_w08_ctx_region_multiply(ctx, region, gf8_inv[divby & 0xff], nbytes, r2, add);
+}
+
+/* Non-temporal stores.  The bytes up to the first 64-byte boundary of
+   dest, and the ragged end, go through the ordinary kernels; the aligned
+   body is written with streaming stores that bypass the cache.  Regions
+   shorter than GALOIS_NT_MIN, and CPUs below AVX2, use ordinary stores
+   throughout.  Each call ends with a store fence, so the data is visible
+   to other threads once it returns. */
+
+void galois_nt_fence(void)
+{
+#ifdef GALOIS_X86_DISPATCH
+  if (galois_simd_level() >= GALOIS_SIMD_AVX2) _mm_sfence();
+#endif
+}
+
+static int galois_nt_head(char *dest, int nbytes)
+{
+  int head;
+
+  if (nbytes < GALOIS_NT_MIN || galois_simd_level() < GALOIS_SIMD_AVX2) return -1;
+  head = (int) ((64 - ((uintptr_t) dest & 63)) & 63);
+  return head;
+}
+
+void galois_w08_ctx_region_multiply_nt(const galois_w08_ctx *ctx, char *region, int multby,
+                                       int nbytes, char *r2, int add)
+{
+  char *dest;
+  int head, i;
+
+  dest = (r2 == NULL) ? region : r2;
+  if (r2 == NULL) add = 0;
+  multby &= 0xff;
+  head = galois_nt_head(dest, nbytes);
+
+  if (multby <= 1 || head < 0) {
+    if (multby == 1 && add && head >= 0) {
+      galois_region_xor_nt(region, dest, nbytes);
+    } else {
+      galois_w08_ctx_region_multiply(ctx, region, multby, nbytes, r2, add);
+    }
+    return;
+  }
+
+  galois_w08_mul_region((uint8_t *) region, (uint8_t *) dest, &ctx->mul[multby], head, add);
+  i = head;
+#ifdef GALOIS_X86_DISPATCH
+  if (galois_simd_level() == GALOIS_SIMD_GFNI) {
+    i += galois_w08_mul_gfni_nt((uint8_t *) region + i, (uint8_t *) dest + i,
+                                &ctx->mul[multby], nbytes - i, add);
+  } else {
+    i += galois_w08_mul_avx2_nt((uint8_t *) region + i, (uint8_t *) dest + i,
+                                &ctx->mul[multby], nbytes - i, add);
+  }
+#endif
+  galois_w08_mul_region((uint8_t *) region + i, (uint8_t *) dest + i, &ctx->mul[multby],
+                        nbytes - i, add);
+  galois_nt_fence();
+}
+
+/* While w=8 is still the default field, region multiplies run on the
+   kernels above with the default context.  A field installed with
+   galois_change_technique() keeps its own multiply_region. */
+
 void galois_w08_region_multiply(char *region,      /* Region to multiply */
                                   int multby,       /* Number to multiply by */
                                   int nbytes,        /* Number of bytes in region */
                                   char *r2,          /* If r2 != NULL, products go here */
                                   int add)
 {
-  if (gfp_array[8] == NULL) {
-    galois_init(8);
+  gf_t *gfp;
+
+  gfp = __atomic_load_n(&gfp_array[8], __ATOMIC_ACQUIRE);
+  if (gfp != NULL && !gfp_is_default[8]) {
+    gfp->multiply_region.w32(gfp, region, (r2 == NULL) ? region : r2, multby, nbytes,
+                             (r2 == NULL) ? 0 : add);
+    return;
+  }
+  galois_w08_ctx_region_multiply(galois_w08_ctx_default(), region, multby, nbytes, r2, add);
+}
+
+void galois_w08_region_divide(char *region, int divby, int nbytes, char *r2, int add)
+{
+  galois_w08_region_multiply(region, galois_inverse(divby & 0xff, 8), nbytes, r2, add);
+}
+
+/* Dot products: dest[j] = sum over i of matrix[j*k+i] * src[i], for m
+   outputs at once.  Each source vector is loaded once and multiplied into
+   up to GALOIS_DOT_MAX_OUT accumulators held in registers.  Regions are
+   walked in GALOIS_DOT_TILE-byte tiles so that, when m needs more than
+   one group of accumulators, later groups re-read the tile from L1. */
+
+#define GALOIS_DOT_MAX_OUT 4
+#define GALOIS_DOT_TILE    2048
+
+galois_w08_tables *galois_w08_dot_prod_init(int k, int m, int *matrix)
+{
+  galois_w08_tables *tables;
+  int i;
+
+  tables = (galois_w08_tables *) malloc(sizeof(galois_w08_tables) * k * m);
+  if (tables == NULL) return NULL;
+  if (galois_w08_is_default()) {
+    for (i = 0; i < k * m; i++) tables[i] = galois_w08_ctx_default()->mul[matrix[i] & 0xff];
+  } else {
+    for (i = 0; i < k * m; i++) galois_w08_tables_init(tables + i, matrix[i]);
+  }
+  return tables;
+}
+
+#ifdef GALOIS_X86_DISPATCH
+__attribute__((target("avx2")))
+static void galois_w08_dot_avx2(uint8_t **src, int k, uint8_t **dest, int nout,
+                                const galois_w08_tables *t, int off, int len)
+{
+  __m256i mask, x, lo, hi, a0, a1, a2, a3;
+  const galois_w08_tables *c;
+  int i, j;
+
+  mask = _mm256_set1_epi8(0x0f);
+  for (j = off; j + 32 <= off + len; j += 32) {
+    a0 = a1 = a2 = a3 = _mm256_setzero_si256();
+    for (i = 0; i < k; i++) {
+      x = _mm256_loadu_si256((__m256i *) (src[i] + j));
+      lo = _mm256_and_si256(x, mask);
+      hi = _mm256_and_si256(_mm256_srli_epi64(x, 4), mask);
+      c = t + i;
+      a0 = _mm256_xor_si256(a0, _mm256_xor_si256(
+             _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->lo)), lo),
+             _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->hi)), hi)));
+      if (nout > 1) {
+        c += k;
+        a1 = _mm256_xor_si256(a1, _mm256_xor_si256(
+               _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->lo)), lo),
+               _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->hi)), hi)));
+      }
+      if (nout > 2) {
+        c += k;
+        a2 = _mm256_xor_si256(a2, _mm256_xor_si256(
+               _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->lo)), lo),
+               _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->hi)), hi)));
+      }
+      if (nout > 3) {
+        c += k;
+        a3 = _mm256_xor_si256(a3, _mm256_xor_si256(
+               _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->lo)), lo),
+               _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) c->hi)), hi)));
+      }
+    }
+    _mm256_storeu_si256((__m256i *) (dest[0] + j), a0);
+    if (nout > 1) _mm256_storeu_si256((__m256i *) (dest[1] + j), a1);
+    if (nout > 2) _mm256_storeu_si256((__m256i *) (dest[2] + j), a2);
+    if (nout > 3) _mm256_storeu_si256((__m256i *) (dest[3] + j), a3);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw,gfni")))
+static void galois_w08_dot_gfni(uint8_t **src, int k, uint8_t **dest, int nout,
+                                const galois_w08_tables *t, int off, int len)
+{
+  __m512i x, a0, a1, a2, a3;
+  int i, j;
+
+  for (j = off; j + 64 <= off + len; j += 64) {
+    a0 = a1 = a2 = a3 = _mm512_setzero_si512();
+    for (i = 0; i < k; i++) {
+      x = _mm512_loadu_si512((void *) (src[i] + j));
+      a0 = _mm512_xor_si512(a0, _mm512_gf2p8affine_epi64_epi8(
+             x, _mm512_set1_epi64((long long) t[i].affine), 0));
+      if (nout > 1) {
+        a1 = _mm512_xor_si512(a1, _mm512_gf2p8affine_epi64_epi8(
+               x, _mm512_set1_epi64((long long) t[k + i].affine), 0));
+      }
+      if (nout > 2) {
+        a2 = _mm512_xor_si512(a2, _mm512_gf2p8affine_epi64_epi8(
+               x, _mm512_set1_epi64((long long) t[2 * k + i].affine), 0));
+      }
+      if (nout > 3) {
+        a3 = _mm512_xor_si512(a3, _mm512_gf2p8affine_epi64_epi8(
+               x, _mm512_set1_epi64((long long) t[3 * k + i].affine), 0));
+      }
+    }
+    _mm512_storeu_si512((void *) (dest[0] + j), a0);
+    if (nout > 1) _mm512_storeu_si512((void *) (dest[1] + j), a1);
+    if (nout > 2) _mm512_storeu_si512((void *) (dest[2] + j), a2);
+    if (nout > 3) _mm512_storeu_si512((void *) (dest[3] + j), a3);
+  }
+}
+#endif
+
+static void galois_w08_dot_scalar(uint8_t **src, int k, uint8_t **dest, int nout,
+                                  const galois_w08_tables *t, int off, int len)
+{
+  const galois_w08_tables *c;
+  uint8_t x, acc;
+  int i, j, o;
+
+  for (o = 0; o < nout; o++) {
+    for (j = off; j < off + len; j++) {
+      acc = 0;
+      for (i = 0; i < k; i++) {
+        c = t + o * k + i;
+        x = src[i][j];
+        acc ^= c->lo[x & 0x0f] ^ c->hi[x >> 4];
+      }
+      dest[o][j] = acc;
+    }
+  }
+}
+
+void galois_w08_region_dot_prod(int k, int m, const galois_w08_tables *tables,
+                                char **src, char **dest, int nbytes)
+{
+  uint8_t **s, **d;
+  int level, vec, bulk;
+  int off, len, o, nout;
+
+  s = (uint8_t **) src;
+  d = (uint8_t **) dest;
+  level = galois_simd_level();
+
+  /* Without AVX2 there are too few registers to keep the outputs live, so
+     fall back to one multiply-accumulate pass per coefficient. */
+  if (level < GALOIS_SIMD_AVX2) {
+    for (o = 0; o < m; o++) {
+      for (off = 0; off < k; off++) {
+        galois_w08_mul_region(s[off], d[o], tables + o * k + off, nbytes, off > 0);
+      }
+    }
+    return;
+  }
+
+  vec = (level == GALOIS_SIMD_GFNI) ? 64 : 32;
+  bulk = nbytes - (nbytes % vec);
+
+  for (off = 0; off < bulk; off += GALOIS_DOT_TILE) {
+    len = (bulk - off < GALOIS_DOT_TILE) ? bulk - off : GALOIS_DOT_TILE;
+    for (o = 0; o < m; o += GALOIS_DOT_MAX_OUT) {
+      nout = (m - o < GALOIS_DOT_MAX_OUT) ? m - o : GALOIS_DOT_MAX_OUT;
+#ifdef GALOIS_X86_DISPATCH
+      if (vec == 64) {
+        galois_w08_dot_gfni(s, k, d + o, nout, tables + o * k, off, len);
+      } else {
+        galois_w08_dot_avx2(s, k, d + o, nout, tables + o * k, off, len);
+      }
+#endif
+    }
+  }
+  if (bulk < nbytes) {
+    galois_w08_dot_scalar(s, k, d, m, tables, bulk, nbytes - bulk);
   }
-  gfp_array[8]->multiply_region.w32(gfp_array[8], region, r2, multby, nbytes, add);
 }
 
 void galois_w16_region_multiply(char *region,      /* Region to multiply */
@@ -313,10 +875,9 @@ void galois_w16_region_multiply(char *region,      /* Region to multiply */
                                   char *r2,          /* If r2 != NULL, products go here */
                                   int add)
 {
-  if (gfp_array[16] == NULL) {
-    galois_init(16);
-  }
-  gfp_array[16]->multiply_region.w32(gfp_array[16], region, r2, multby, nbytes, add);
+  gf_t *gfp = galois_field(16);
+
+  gfp->multiply_region.w32(gfp, region, r2, multby, nbytes, add);
 }
 
 
@@ -326,50 +887,221 @@ void galois_w32_region_multiply(char *region,      /* Region to multiply */
                                   char *r2,          /* If r2 != NULL, products go here */
                                   int add)
 {
-  if (gfp_array[32] == NULL) {
-    galois_init(32);
+  gf_t *gfp = galois_field(32);
+
+  gfp->multiply_region.w32(gfp, region, r2, multby, nbytes, add);
+}
+
+/* Region XOR does not depend on w, so every galois_w*_region_xor() and
+   galois_region_xor() goes straight to a SIMD kernel instead of through a
+   field's multiply_region with a multiplier of one. */
+
+#ifdef GALOIS_X86_DISPATCH
+__attribute__((target("avx2")))
+static int galois_xor_avx2(uint8_t *src, uint8_t *dest, int nbytes)
+{
+  int i;
+  __m256i a, b;
+
+  for (i = 0; i + 64 <= nbytes; i += 64) {
+    a = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (src + i)),
+                         _mm256_loadu_si256((__m256i *) (dest + i)));
+    b = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (src + i + 32)),
+                         _mm256_loadu_si256((__m256i *) (dest + i + 32)));
+    _mm256_storeu_si256((__m256i *) (dest + i), a);
+    _mm256_storeu_si256((__m256i *) (dest + i + 32), b);
+  }
+  for (; i + 32 <= nbytes; i += 32) {
+    a = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (src + i)),
+                         _mm256_loadu_si256((__m256i *) (dest + i)));
+    _mm256_storeu_si256((__m256i *) (dest + i), a);
+  }
+  return i;
+}
+
+__attribute__((target("avx512f")))
+static int galois_xor_avx512(uint8_t *src, uint8_t *dest, int nbytes)
+{
+  int i;
+  __m512i a;
+
+  for (i = 0; i + 64 <= nbytes; i += 64) {
+    a = _mm512_xor_si512(_mm512_loadu_si512((void *) (src + i)),
+                         _mm512_loadu_si512((void *) (dest + i)));
+    _mm512_storeu_si512((void *) (dest + i), a);
   }
-  gfp_array[32]->multiply_region.w32(gfp_array[32], region, r2, multby, nbytes, add);
+  return i;
 }
 
-void galois_w8_region_xor(void *src, void *dest, int nbytes)
+__attribute__((target("avx2")))
+static int galois_xor_n_avx2(uint8_t *dest, uint8_t **srcs, int nsrcs, int nbytes)
 {
-  if (gfp_array[8] == NULL) {
-    galois_init(8);
+  int i, j;
+  __m256i a;
+
+  for (i = 0; i + 32 <= nbytes; i += 32) {
+    a = _mm256_loadu_si256((__m256i *) (srcs[0] + i));
+    for (j = 1; j < nsrcs; j++) {
+      a = _mm256_xor_si256(a, _mm256_loadu_si256((__m256i *) (srcs[j] + i)));
+    }
+    _mm256_storeu_si256((__m256i *) (dest + i), a);
   }
-  gfp_array[8]->multiply_region.w32(gfp_array[32], src, dest, 1, nbytes, 1);
+  return i;
 }
 
-void galois_w16_region_xor(void *src, void *dest, int nbytes)
+__attribute__((target("avx512f")))
+static int galois_xor_n_avx512(uint8_t *dest, uint8_t **srcs, int nsrcs, int nbytes)
 {
-  if (gfp_array[16] == NULL) {
-    galois_init(16);
+  int i, j;
+  __m512i a;
+
+  for (i = 0; i + 64 <= nbytes; i += 64) {
+    a = _mm512_loadu_si512((void *) (srcs[0] + i));
+    for (j = 1; j < nsrcs; j++) {
+      a = _mm512_xor_si512(a, _mm512_loadu_si512((void *) (srcs[j] + i)));
+    }
+    _mm512_storeu_si512((void *) (dest + i), a);
   }
-  gfp_array[16]->multiply_region.w32(gfp_array[16], src, dest, 1, nbytes, 1);
+  return i;
 }
 
-void galois_w32_region_xor(void *src, void *dest, int nbytes)
+__attribute__((target("avx2")))
+static int galois_xor_avx2_nt(uint8_t *src, uint8_t *dest, int nbytes)
+{
+  int i;
+  __m256i a;
+
+  for (i = 0; i + 32 <= nbytes; i += 32) {
+    a = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (src + i)),
+                         _mm256_load_si256((__m256i *) (dest + i)));
+    _mm256_stream_si256((__m256i *) (dest + i), a);
+  }
+  return i;
+}
+
+__attribute__((target("avx512f")))
+static int galois_xor_avx512_nt(uint8_t *src, uint8_t *dest, int nbytes)
 {
-  if (gfp_array[32] == NULL) {
-    galois_init(32);
+  int i;
+  __m512i a;
+
+  for (i = 0; i + 64 <= nbytes; i += 64) {
+    a = _mm512_xor_si512(_mm512_loadu_si512((void *) (src + i)),
+                         _mm512_load_si512((void *) (dest + i)));
+    _mm512_stream_si512((void *) (dest + i), a);
   }
-  gfp_array[32]->multiply_region.w32(gfp_array[32], src, dest, 1, nbytes, 1);
+  return i;
 }
+#endif
 
+/* Word-at-a-time tail.  memcpy keeps unaligned regions legal and
+   compiles to plain loads and stores. */
 
+static void galois_xor_word(uint8_t *src, uint8_t *dest, int i, int nbytes)
+{
+  uint64_t a, b;
+
+  for (; i + 8 <= nbytes; i += 8) {
+    memcpy(&a, src + i, 8);
+    memcpy(&b, dest + i, 8);
+    b ^= a;
+    memcpy(dest + i, &b, 8);
+  }
+  for (; i < nbytes; i++) dest[i] ^= src[i];
+}
 
 void galois_region_xor(char *src, char *dest, int nbytes)
 {
-  if (nbytes >= 16) {
-    galois_w32_region_xor(src, dest, nbytes);
+  int level;
+  int i;
+
+  i = 0;
+#ifdef GALOIS_X86_DISPATCH
+  level = galois_simd_level();
+  if (level >= GALOIS_SIMD_AVX512) {
+    i = galois_xor_avx512((uint8_t *) src, (uint8_t *) dest, nbytes);
+  }
+  if (level >= GALOIS_SIMD_AVX2) {
+    i += galois_xor_avx2((uint8_t *) src + i, (uint8_t *) dest + i, nbytes - i);
+  }
+#endif
+  galois_xor_word((uint8_t *) src, (uint8_t *) dest, i, nbytes);
+}
+
+void galois_region_xor_nt(char *src, char *dest, int nbytes)
+{
+  int head, i;
+
+  head = galois_nt_head(dest, nbytes);
+  if (head < 0) {
+    galois_region_xor(src, dest, nbytes);
+    return;
+  }
+  galois_region_xor(src, dest, head);
+  i = head;
+#ifdef GALOIS_X86_DISPATCH
+  if (galois_simd_level() >= GALOIS_SIMD_AVX512) {
+    i += galois_xor_avx512_nt((uint8_t *) src + i, (uint8_t *) dest + i, nbytes - i);
   } else {
-    int i = 0;
-    for (i = 0; i < nbytes; i++) {
-      *dest ^= *src;
-      dest++;
-      src++;
-    } 
+    i += galois_xor_avx2_nt((uint8_t *) src + i, (uint8_t *) dest + i, nbytes - i);
+  }
+#endif
+  galois_region_xor(src + i, dest + i, nbytes - i);
+  galois_nt_fence();
+}
+
+void galois_region_xor_n(char *dest, char **srcs, int nsrcs, int nbytes)
+{
+  uint8_t **s;
+  uint64_t a, b;
+  int i, j;
+
+  if (nsrcs <= 0) {
+    memset(dest, 0, nbytes);
+    return;
+  }
+  if (nsrcs == 2 && srcs[0] == dest) {
+    galois_region_xor(srcs[1], dest, nbytes);
+    return;
   }
+
+  s = (uint8_t **) srcs;
+  i = 0;
+#ifdef GALOIS_X86_DISPATCH
+  if (galois_simd_level() >= GALOIS_SIMD_AVX512) {
+    i = galois_xor_n_avx512((uint8_t *) dest, s, nsrcs, nbytes);
+  } else if (galois_simd_level() >= GALOIS_SIMD_AVX2) {
+    i = galois_xor_n_avx2((uint8_t *) dest, s, nsrcs, nbytes);
+  }
+#endif
+  for (; i + 8 <= nbytes; i += 8) {
+    memcpy(&a, s[0] + i, 8);
+    for (j = 1; j < nsrcs; j++) {
+      memcpy(&b, s[j] + i, 8);
+      a ^= b;
+    }
+    memcpy(dest + i, &a, 8);
+  }
+  for (; i < nbytes; i++) {
+    a = s[0][i];
+    for (j = 1; j < nsrcs; j++) a ^= s[j][i];
+    dest[i] = (char) a;
+  }
+}
+
+void galois_w8_region_xor(void *src, void *dest, int nbytes)
+{
+  galois_region_xor((char *) src, (char *) dest, nbytes);
+}
+
+void galois_w16_region_xor(void *src, void *dest, int nbytes)
+{
+  galois_region_xor((char *) src, (char *) dest, nbytes);
+}
+
+void galois_w32_region_xor(void *src, void *dest, int nbytes)
+{
+  galois_region_xor((char *) src, (char *) dest, nbytes);
 }
 
 
@@ -411,124 +1143,13 @@ int galois_inverse(int y, int w)
 
 
 
-int LOG_TABLE[]= {
-            -1,    0,    1,   25,    2,   50,   26,  198,
-            3,  223,   51,  238,   27,  104,  199,   75,
-            4,  100,  224,   14,   52,  141,  239,  129,
-            28,  193,  105,  248,  200,    8,   76,  113,
-            5,  138,  101,   47,  225,   36,   15,   33,
-            53,  147,  142,  218,  240,   18,  130,   69,
-            29,  181,  194,  125,  106,   39,  249,  185,
-            201,  154,    9,  120,   77,  228,  114,  166,
-            6,  191,  139,   98,  102,  221,   48,  253,
-            226,  152,   37,  179,   16,  145,   34,  136,
-            54,  208,  148,  206,  143,  150,  219,  189,
-            241,  210,   19,   92,  131,   56,   70,   64,
-            30,   66,  182,  163,  195,   72,  126,  110,
-            107,   58,   40,   84,  250,  133,  186,   61,
-            202,   94,  155,  159,   10,   21,  121,   43,
-            78,  212,  229,  172,  115,  243,  167,   87,
-            7,  112,  192,  247,  140,  128,   99,   13,
-            103,   74,  222,  237,   49,  197,  254,   24,
-            227,  165,  153,  119,   38,  184,  180,  124,
-            17,   68,  146,  217,   35,   32,  137,   46,
-            55,   63,  209,   91,  149,  188,  207,  205,
-            144,  135,  151,  178,  220,  252,  190,   97,
-            242,   86,  211,  171,   20,   42,   93,  158,
-            132,   60,   57,   83,   71,  109,   65,  162,
-            31,   45,   67,  216,  183,  123,  164,  118,
-            196,   23,   73,  236,  127,   12,  111,  246,
-            108,  161,   59,   82,   41,  157,   85,  170,
-            251,   96,  134,  177,  187,  204,   62,   90,
-            203,   89,   95,  176,  156,  169,  160,   81,
-            11,  245,   22,  235,  122,  117,   44,  215,
-            79,  174,  213,  233,  230,  231,  173,  232,
-            116,  214,  244,  234,  168,   80,   88,  175
-
-    };
-int EXP_TABLE[] ={
-            1,    2,    4,    8,   16,   32,   64, -128,
-            29,   58,  116,  -24,  -51, -121,   19,   38,
-            76, -104,   45,   90,  -76,  117,  -22,  -55,
-            -113,    3,    6,   12,   24,   48,   96,  -64,
-            -99,   39,   78, -100,   37,   74, -108,   53,
-            106,  -44,  -75,  119,  -18,  -63,  -97,   35,
-            70, -116,    5,   10,   20,   40,   80,  -96,
-            93,  -70,  105,  -46,  -71,  111,  -34,  -95,
-            95,  -66,   97,  -62, -103,   47,   94,  -68,
-            101,  -54, -119,   15,   30,   60,  120,  -16,
-            -3,  -25,  -45,  -69,  107,  -42,  -79,  127,
-            -2,  -31,  -33,  -93,   91,  -74,  113,  -30,
-            -39,  -81,   67, -122,   17,   34,   68, -120,
-            13,   26,   52,  104,  -48,  -67,  103,  -50,
-            -127,   31,   62,  124,   -8,  -19,  -57, -109,
-            59,  118,  -20,  -59, -105,   51,  102,  -52,
-            -123,   23,   46,   92,  -72,  109,  -38,  -87,
-            79,  -98,   33,   66, -124,   21,   42,   84,
-            -88,   77, -102,   41,   82,  -92,   85,  -86,
-            73, -110,   57,  114,  -28,  -43,  -73,  115,
-            -26,  -47,  -65,   99,  -58, -111,   63,  126,
-            -4,  -27,  -41,  -77,  123,  -10,  -15,   -1,
-            -29,  -37,  -85,   75, -106,   49,   98,  -60,
-            -107,   55,  110,  -36,  -91,   87,  -82,   65,
-            -126,   25,   50,  100,  -56, -115,    7,   14,
-            28,   56,  112,  -32,  -35,  -89,   83,  -90,
-            81,  -94,   89,  -78,  121,  -14,   -7,  -17,
-            -61, -101,   43,   86,  -84,   69, -118,    9,
-            18,   36,   72, -112,   61,  122,  -12,  -11,
-            -9,  -13,   -5,  -21,  -53, -117,   11,   22,
-            44,   88,  -80,  125,   -6,  -23,  -49, -125,
-            27,   54,  108,  -40,  -83,   71, -114,
-            // Repeat the table a second time, so multiply()
-            // does not have to check bounds.
-            1,    2,    4,    8,   16,   32,   64, -128,
-            29,   58,  116,  -24,  -51, -121,   19,   38,
-            76, -104,   45,   90,  -76,  117,  -22,  -55,
-            -113,    3,    6,   12,   24,   48,   96,  -64,
-            -99,   39,   78, -100,   37,   74, -108,   53,
-            106,  -44,  -75,  119,  -18,  -63,  -97,   35,
-            70, -116,    5,   10,   20,   40,   80,  -96,
-            93,  -70,  105,  -46,  -71,  111,  -34,  -95,
-            95,  -66,   97,  -62, -103,   47,   94,  -68,
-            101,  -54, -119,   15,   30,   60,  120,  -16,
-            -3,  -25,  -45,  -69,  107,  -42,  -79,  127,
-            -2,  -31,  -33,  -93,   91,  -74,  113,  -30,
-            -39,  -81,   67, -122,   17,   34,   68, -120,
-            13,   26,   52,  104,  -48,  -67,  103,  -50,
-            -127,   31,   62,  124,   -8,  -19,  -57, -109,
-            59,  118,  -20,  -59, -105,   51,  102,  -52,
-            -123,   23,   46,   92,  -72,  109,  -38,  -87,
-            79,  -98,   33,   66, -124,   21,   42,   84,
-            -88,   77, -102,   41,   82,  -92,   85,  -86,
-            73, -110,   57,  114,  -28,  -43,  -73,  115,
-            -26,  -47,  -65,   99,  -58, -111,   63,  126,
-            -4,  -27,  -41,  -77,  123,  -10,  -15,   -1,
-            -29,  -37,  -85,   75, -106,   49,   98,  -60,
-            -107,   55,  110,  -36,  -91,   87,  -82,   65,
-            -126,   25,   50,  100,  -56, -115,    7,   14,
-            28,   56,  112,  -32,  -35,  -89,   83,  -90,
-            81,  -94,   89,  -78,  121,  -14,   -7,  -17,
-            -61, -101,   43,   86,  -84,   69, -118,    9,
-            18,   36,   72, -112,   61,  122,  -12,  -11,
-            -9,  -13,   -5,  -21,  -53, -117,   11,   22,
-            44,   88,  -80,  125,   -6,  -23,  -49, -125,
-            27,   54,  108,  -40,  -83,   71, -114
-    };
-
-
- char divide(char a, char b) {
-        if (a == 0) {
-            return 0;
-        }
-       
-        int logA = LOG_TABLE[a & 0xFF];
-        int logB = LOG_TABLE[b & 0xFF];
-        int logResult = logA - logB;
-        if (logResult < 0) {
-            logResult += 255;
-        }
-        return EXP_TABLE[logResult];
-    }
+/* Byte-wise divide in the default w=8 field (kept for the scalar
+   reference paths).  Arguments are taken as unsigned bytes. */
+
+char divide(char a, char b)
+{
+  return (char) gf8_div((uint8_t) a, (uint8_t) b);
+}
 
 
 void galois_region_xor1(           char *r1,         /* Region 1 */
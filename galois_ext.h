@@ -0,0 +1,93 @@
+/* galois_ext.h
+ * Region routines that this tree's galois.c adds on top of Jerasure's
+ * galois.h.  Include it after galois.h.
+ */
+
+#ifndef _GALOIS_EXT_H
+#define _GALOIS_EXT_H
+
+#include <stdint.h>
+
+/* SIMD tiers, in increasing order.  galois.c picks the highest one the CPU
+   supports the first time a region routine runs.  GFNI means GF2P8AFFINEQB
+   on 512-bit vectors; AVX512 without GFNI only speeds up XOR. */
+
+#define GALOIS_SIMD_NONE    0
+#define GALOIS_SIMD_SSSE3   1
+#define GALOIS_SIMD_AVX2    2
+#define GALOIS_SIMD_AVX512  3
+#define GALOIS_SIMD_GFNI    4
+
+extern int galois_simd_level(void);
+
+/* Nonzero while w=8 is the default GF(2^8) mod 0x11d of gf8.h, i.e. no
+   other field or technique has been installed for w=8. */
+
+extern int galois_w08_is_default(void);
+
+/* Per-constant tables for w=8 region kernels: split-nibble products for
+   pshufb and the bit matrix for GF2P8AFFINEQB. */
+
+typedef struct {
+  unsigned char lo[16];
+  unsigned char hi[16];
+  uint64_t affine;
+} galois_w08_tables;
+
+extern void galois_w08_tables_init(galois_w08_tables *t, int multby);
+
+/* An immutable w=8 field context: the tables for all 256 constants.
+   galois_w08_ctx_default() returns the shared context for GF(2^8) mod
+   0x11d, built once on first call; it is safe to use from any number of
+   threads.  The ctx region routines take galois_w08_region_multiply()'s
+   r2 and add conventions and never touch the global field state. */
+
+typedef struct {
+  galois_w08_tables mul[256];
+} galois_w08_ctx;
+
+extern const galois_w08_ctx *galois_w08_ctx_default(void);
+extern void galois_w08_ctx_region_multiply(const galois_w08_ctx *ctx, char *region, int multby,
+                                           int nbytes, char *r2, int add);
+extern void galois_w08_ctx_region_divide(const galois_w08_ctx *ctx, char *region, int divby,
+                                         int nbytes, char *r2, int add);
+
+/* Variants that write the aligned body of the output with non-temporal
+   stores, for outputs that will not be read again while they could still
+   be in cache (final coupled sub-chunks on their way to disk).  Outputs
+   shorter than GALOIS_NT_MIN bytes are written normally.  The stores are
+   fenced before return; galois_nt_fence() does the same for callers that
+   drive their own streaming kernels. */
+
+#define GALOIS_NT_MIN 4096
+
+extern void galois_w08_ctx_region_multiply_nt(const galois_w08_ctx *ctx, char *region, int multby,
+                                              int nbytes, char *r2, int add);
+extern void galois_region_xor_nt(char *src, char *dest, int nbytes);
+extern void galois_nt_fence(void);
+
+/* region / divby, with galois_w08_region_multiply()'s r2 and add
+   conventions.  divby must be nonzero. */
+
+extern void galois_w08_region_divide(char *region, int divby, int nbytes, char *r2, int add);
+
+/* dest[j] = sum over i < k of matrix[j*k+i] * src[i] for j < m, streaming
+   each source once.  galois_w08_dot_prod_init() builds the k*m tables from
+   a Jerasure-style row-major matrix; free them with free(). */
+
+extern galois_w08_tables *galois_w08_dot_prod_init(int k, int m, int *matrix);
+extern void galois_w08_region_dot_prod(int k, int m, const galois_w08_tables *tables,
+                                       char **src, char **dest, int nbytes);
+
+/* dest ^= src */
+extern void galois_w8_region_xor(void *src, void *dest, int nbytes);
+extern void galois_w16_region_xor(void *src, void *dest, int nbytes);
+extern void galois_w32_region_xor(void *src, void *dest, int nbytes);
+
+/* dest = srcs[0] ^ srcs[1] ^ ... ^ srcs[nsrcs-1], in one pass over memory.
+   dest may be one of the sources. */
+extern void galois_region_xor_n(char *dest, char **srcs, int nsrcs, int nbytes);
+
+extern void galois_region_xor1(char *r1, char *r2, char *r3, int nbytes);
+
+#endif
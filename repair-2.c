@@ -66,6 +66,7 @@ same arguments, and encoder.c does error check.
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include "jerasure.h"
@@ -74,9 +75,10 @@ same arguments, and encoder.c does error check.
 #include "cauchy.h"
 #include "liberation.h"
 #include "timing.h"
+#include "clay.h"
+#include "clay_io.h"
 
 #define N 10
-#define M 128
 #define r 2
 enum Coding_Technique {Reed_Sol_Van, Reed_Sol_R6_Op, Cauchy_Orig, Cauchy_Good, Liberation, Blaum_Roth, Liber8tion, RDP, EVENODD, No_Coding};
 
@@ -89,6 +91,70 @@ int readins, n;
 /* Function prototype */
 void ctrl_bs_handler(int dummy);
 
+/* The file of node i: _k for data, _m for parity nodes */
+static void node_file(char *fname, const char *curdir, const char *cs1, int md, int k, int i,
+	const char *extension)
+{
+	if (i < k) {
+		sprintf(fname, "%s/Coding/%s_k%0*d%s", curdir, cs1, md, i, extension);
+	}
+	else {
+		sprintf(fname, "%s/Coding/%s_m%0*d%s", curdir, cs1, md, i-k, extension);
+	}
+}
+
+/* Waits for completions up to the operation tagged until, or with until
+   NULL for all outstanding ones.  Tags are the names of the files; reads
+   must return len bytes and writes no error.  Exits naming the file on
+   any failure. */
+static void wait_io(clay_io *io, const char *until, long len)
+{
+	void *tag;
+	long res;
+
+	while (clay_io_outstanding(io) > 0) {
+		if (clay_io_wait(io, &tag, &res) < 0) {
+			fprintf(stderr, "Node file I/O failed.\n");
+			exit(0);
+		}
+		if (until != NULL && tag == until) {
+			if (res < 0) {
+				fprintf(stderr, "Unable to write %s.\n", until);
+				exit(0);
+			}
+			return;
+		}
+		if (res != len) {
+			fprintf(stderr, "Unable to read %s.\n", (const char *)tag);
+			exit(0);
+		}
+	}
+}
+
+/* Queues readin n of every open node file into the node-major buffers
+   viewed by fdata and fcoding, and submits it */
+static void read_readin(clay_io *io, const clay_code *code, int *node_fd, char **node_name,
+	char **fdata, char **fcoding, int blocksize, int n)
+{
+	int i;
+
+	for (i = 0; i < code->n; i++) {
+		if (node_fd[i] < 0) {
+			continue;
+		}
+		if (clay_io_read(io, node_fd[i], clay_code_subchunk(code, fdata, fcoding, i, 0, blocksize),
+		                 (long)code->alpha*blocksize, (off_t)(n-1)*code->alpha*blocksize, -1,
+		                 node_name[i]) < 0) {
+			fprintf(stderr, "Unable to read %s.\n", node_name[i]);
+			exit(0);
+		}
+	}
+	if (clay_io_submit(io) < 0) {
+		fprintf(stderr, "Unable to submit the reads of readin %d.\n", n);
+		exit(0);
+	}
+}
+
 int main (int argc, char **argv) {
 	FILE *fp;				// File pointer
 
@@ -101,19 +167,28 @@ int main (int argc, char **argv) {
 	int *bitmatrix;
 	char **fdata;
 	char **fcoding;
-	char **tempcoding;
-	char **tempdata;
+	char *databuf[2];		// data nodes, node-major, per readin in flight
+	char *codingbuf[2];		// parity nodes, node-major
+	char **fdata_set[2];		// layer views of databuf[]
+	char **fcoding_set[2];
+	int nbufs, cur;
 	/* Parameters */
-	int k, m, w, packetsize, buffersize;
+	int k, m, w, packetsize;
+	long long buffersize;		// input bytes per readin
+	int d;
 	int tech;
 	char *c_tech;
-	int jj;
-	int i, j,i1,j1,i4,i5;				// loop control variable, s
+	int i, j,j1,i4;				// loop control variable, s
 	int blocksize = 0;			// size of individual files
-	int origsize;			// size of file before padding
+	long long origsize;		// size of file before padding
 	int total;				// used to write data, not padding to file
 	struct stat status;		// used to find size of individual files
 	int numerased;			// number of erased files
+	clay_io *io;			// batched node file I/O
+	int *node_fd;
+	char **node_name;		// node file names, the tags of their reads
+	struct iovec out_iov;		// the repaired node's readin
+	int out_fd;			// opened with the first readin
 		
 	/* Used to recreate file names */
 	char *temp;
@@ -132,12 +207,17 @@ int main (int argc, char **argv) {
 	double matrix_time;
 	double sum_time;
 	double save_value_time;
-//...................
-char **extra;
-char **factor;
-char *cons;
-char **load;
-char **load1;	
+	/* Repair layout */
+	clay_code *code;
+	clay_coupler *coupler;
+	clay_decoder_cache *decoder_cache;	// w=8 decoding rows by erasure pattern
+	const clay_layer_decoder *layer_decoder;
+	int alpha;
+	int lost;				// node being repaired
+	int *helper;
+	clay_plan *repair_plan;			// helper pairs in the repair layers
+	char **scratch;				// decoded sub-chunks of erased nodes
+	int z, i3;
 	signal(SIGQUIT, ctrl_bs_handler);
 
 	matrix = NULL;
@@ -188,11 +268,11 @@ char **load1;
 		exit(0);
 	}
 	
-	if (fscanf(fp, "%d", &origsize) != 1) {
+	if (fscanf(fp, "%lld", &origsize) != 1) {
 		fprintf(stderr, "Original size is not valid\n");
 		exit(0);
 	}
-	if (fscanf(fp, "%d %d %d %d %d", &k, &m, &w, &packetsize, &buffersize) != 5) {
+	if (fscanf(fp, "%d %d %d %d %lld", &k, &m, &w, &packetsize, &buffersize) != 5) {
 		fprintf(stderr, "Parameters are not correct\n");
 		exit(0);
 	}
@@ -210,18 +290,34 @@ char **load1;
 		fprintf(stderr, "Metadata file - bad format\n");
 		exit(0);
 	}
+	/* Files encoded before d was recorded use the q = 2 layout */
+	if (fscanf(fp, "%d", &d) != 1) {
+		d = k + 1;
+	}
 	fclose(fp);	
 
+	code = clay_code_new(k + m, k, d);
+	if (code == NULL) {
+		fprintf(stderr, "No Clay layout for n=%d k=%d d=%d\n", k + m, k, d);
+		exit(0);
+	}
+	alpha = code->alpha;
+
 	/* Allocate memory */
 	erased = (int *)malloc(sizeof(int)*(k+m));
 	for (i = 0; i < k+m; i++)
 		erased[i] = 0;
 	erasures = (int *)malloc(sizeof(int)*(k+m));
+	node_fd = (int *)malloc(sizeof(int)*(k+m));
+	node_name = (char **)malloc(sizeof(char *)*(k+m));
+	io = clay_io_new(k+m+1);
+	if (node_fd == NULL || io == NULL) {
+		fprintf(stderr, "Unable to set up file I/O.\n");
+		exit(0);
+	}
 
 	data = (char **)malloc(sizeof(char *)*k);
 	coding = (char **)malloc(sizeof(char *)*m);
-	tempdata = (char **)malloc(sizeof(char *)*k);
-	tempcoding = (char **)malloc(sizeof(char *)*m);
 
 
 
@@ -238,22 +334,10 @@ char **load1;
 
 
 			
-	if (buffersize != origsize) {
-		for (i = 0; i < k; i++) {
-			data[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-			tempdata[i] = (char *)malloc(sizeof(char *)*(buffersize/k));
-		}
-		for (i = 0; i < m; i++) {
-			coding[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-			tempcoding[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-		}
-		blocksize = buffersize/k;
-	}
-
 	sprintf(temp, "%d", k);
 	md = strlen(temp);
 	
-        printf("buffersize:%d\n", buffersize);
+        printf("buffersize:%lld\n", buffersize);
    
 	//if (buffersize = origsize) {
 	//blocksize=224;}
@@ -289,6 +373,19 @@ char **load1;
 		case Liber8tion:
 			bitmatrix = liber8tion_coding_bitmatrix(k);
 	}
+
+	/* Same sub-chunk layout as the encoder: w-packet groups for the
+	   cauchy codes, GF(2^8) bytes otherwise */
+	if (tech == Cauchy_Orig || tech == Cauchy_Good) {
+		coupler = clay_coupler_new(r, w, packetsize);
+	}
+	else {
+		coupler = clay_coupler_new(r, 8, 0);
+	}
+	if (coupler == NULL) {
+		fprintf(stderr, "Unable to set up coupling for w=%d packetsize=%d.\n", w, packetsize);
+		exit(0);
+	}
 	
 	
 	printf("matrix: \n");
@@ -298,764 +395,188 @@ printf("\n");
 printf( " 0\n");
 
 
-	/* Begin decoding process */
-	total = 0;
-	n = 1;	
-	while (n <= readins) {
-		numerased = 0;
-		/* Open files, check for erasures, read in data/coding */	
-			
-		for (i = 0; i < k; i++) {
-			sprintf(fname, "%s/Coding/%s_k%0*d%s", curdir, cs1, md, i, extension);
-			fp = fopen(fname, "rb");
-			if (fp == NULL) {
-				erased[i] = 1;
-				erasures[numerased] = i;
-				numerased++;}
-				
-			else {
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size/M;
-					//blocksize=224;
-					//blocksize=112;
-					data[i] = (char *)malloc(sizeof(char)*blocksize);
-					tempdata[i] = (char *)malloc(sizeof(char)*M*blocksize);
-					assert(M*blocksize == fread(tempdata[i], sizeof(char), M*blocksize, fp));
-				}
-				
-				fclose(fp);
-			}
+	/* The missing node file is the node to repair.  Readin n is the
+	   n-th run of alpha sub-chunks in every file. */
+	numerased = 0;
+	blocksize = 0;
+	for (i = 0; i < k+m; i++) {
+		node_file(fname, curdir, cs1, md, k, i, extension);
+		node_name[i] = strdup(fname);
+		node_fd[i] = -1;
+		if (stat(fname, &status) < 0) {
+			erasures[numerased] = i;
+			numerased++;
 		}
-				
-					
-		for (i = 0; i < m; i++) {
-			sprintf(fname, "%s/Coding/%s_m%0*d%s", curdir, cs1, md, i, extension);
-				fp = fopen(fname, "rb");
-				if (fp == NULL) {
-				erased[k+i] = 1;
-				erasures[numerased] = k+i;
-				numerased++;}	
-			else{
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size/M;
-					//blocksize=224;
-					//blocksize=112;
-					coding[i] = (char *)malloc(sizeof(char)*blocksize);
-					tempcoding[i] = (char *)malloc(sizeof(char)*M*blocksize);
-					assert(M*blocksize == fread(tempcoding[i], sizeof(char), M*blocksize, fp));
-				}
-					
-				fclose(fp);
-			}
+		else if (blocksize == 0) {
+			blocksize = status.st_size/((long long)alpha*readins);
 		}
+	}
 printf("\n");
 printf("blocksize:%d\n", blocksize);
+	if (clay_coupler_check(coupler, blocksize) < 0) {
+		fprintf(stderr, "Sub-chunks of %d bytes are not whole w*packetsize groups.\n", blocksize);
+		exit(0);
+	}
 printf("\n");
-	/* Finish allocating data/coding if needed */
-		if (n == 1) {
-			for (i = 0; i < numerased; i++) {
-				if (erasures[i] < k) {
-					data[erasures[i]] = (char *)malloc(sizeof(char)*blocksize);
-					tempdata[erasures[i]] = (char *)malloc(sizeof(char)*M*blocksize);
-				}
-				else {
-					coding[erasures[i]-k] = (char *)malloc(sizeof(char)*blocksize);
-					tempcoding[erasures[i]-k] = (char *)malloc(sizeof(char)*M*blocksize);
-				}
-			}
+
+	/* In every repair layer the lost node's row and the nodes that do
+	   not help are decoded; the helpers' sub-chunks of those layers are
+	   decoupled first.  The same node is missing from every readin. */
+	if (numerased != 1) {
+		fprintf(stderr, "Repair needs exactly one missing node, found %d\n", numerased);
+		exit(0);
+	}
+	lost = erasures[0];
+	helper = (int *)malloc(sizeof(int)*(k+m));
+	if (clay_code_helpers(code, lost, helper) < 0) {
+		fprintf(stderr, "No repair helpers for n=%d k=%d d=%d\n", k + m, k, d);
+		exit(0);
+	}
+	scratch = (char **)malloc(sizeof(char *)*(k+m));
+	numerased = 0;
+	for (i = 0; i < k+m; i++) {
+		erased[i] = (code->y[i] == code->y[lost] || !helper[i]);
+		if (erased[i]) erasures[numerased++] = i;
+		scratch[i] = NULL;
+		if (erased[i] && i != lost) scratch[i] = (char *)malloc(sizeof(char)*blocksize);
+	}
+	erasures[numerased] = -1;
+
+	/* Only the d helpers are opened and read, once */
+	for (i = 0; i < k+m; i++) {
+		if (!helper[i]) {
+			continue;
+		}
+		node_fd[i] = open(node_name[i], O_RDONLY);
+		if (node_fd[i] < 0) {
+			fprintf(stderr, "Unable to open %s.\n", node_name[i]);
+			exit(0);
+		}
+	}
+	repair_plan = clay_code_repair_plan(code, lost, helper);
+	if (repair_plan == NULL) {
+		fprintf(stderr, "Unable to plan the repair.\n");
+		exit(0);
+	}
+	/* Each node's readin is held as in its file and repaired where it
+	   was read; fdata[z] and fcoding[z] are views of layer z.  With more
+	   than one readin the next is read into a second set of buffers
+	   while this one is repaired and written. */
+	nbufs = (readins > 1) ? 2 : 1;
+	for (cur = 0; cur < nbufs; cur++) {
+		databuf[cur] = (char *)malloc((size_t)k*alpha*blocksize);
+		codingbuf[cur] = (char *)malloc((size_t)m*alpha*blocksize);
+		fdata_set[cur] = (char **)malloc(sizeof(char*)*alpha);
+		fcoding_set[cur] = (char **)malloc(sizeof(char*)*alpha);
+		if (databuf[cur] == NULL || codingbuf[cur] == NULL || fdata_set[cur] == NULL ||
+		    fcoding_set[cur] == NULL) {
+			fprintf(stderr, "Unable to allocate %lld bytes for a readin.\n",
+				(long long)(k+m)*alpha*blocksize);
+			exit(0);
+		}
+		for (z = 0; z < alpha; z++) {
+			fdata_set[cur][z] = databuf[cur] + (long)z*blocksize;
+			fcoding_set[cur][z] = codingbuf[cur] + (long)z*blocksize;
 		}
-		erasures[numerased] = -1;
+	}
+	code->stride = (long)alpha*blocksize;
+
+	decoder_cache = NULL;
+	if ((tech == Reed_Sol_Van || tech == Reed_Sol_R6_Op) && w == 8) {
+		decoder_cache = clay_decoder_cache_new(k, m, matrix, 0);
+		if (decoder_cache == NULL) {
+			fprintf(stderr, "Unsuccessful!\n");
+			exit(0);
+		}
+	}
 
+	/* Begin decoding process */
+	out_fd = -1;
+	total = 0;
+	read_readin(io, code, node_fd, node_name, fdata_set[0], fcoding_set[0], blocksize, 1);
+	n = 1;	
+	while (n <= readins) {
+		/* This readin was queued before; queue the next one behind it */
+		cur = (n-1) % nbufs;
+		fdata = fdata_set[cur];
+		fcoding = fcoding_set[cur];
+		wait_io(io, NULL, (long)alpha*blocksize);
+		if (n < readins) {
+			read_readin(io, code, node_fd, node_name, fdata_set[n % nbufs], fcoding_set[n % nbufs],
+				blocksize, n+1);
+		}
 printf( " 1\n");
-fdata = (char **)malloc(sizeof(char*)*M);
-fcoding = (char **)malloc(sizeof(char*)*M);
-for(j = 0; j < M; j++) {
-fdata[j] = (char *)malloc(sizeof(char)*k*blocksize);
-fcoding[j] = (char *)malloc(sizeof(char)*m*blocksize);}
 
 printf( " 2\n");
-                 	for(i=0;i<M;i++){
-                 	for(j1=0;j1<k;j1++){
-                 	for(j=0;j<blocksize;j++){           
-                	 fdata[i][j+j1*blocksize]=*(tempdata[j1]+j+i*blocksize);}}}
                   	
    		
 
 printf( " 3\n");
-     			 for(i=0;i<M;i++){
-    			 for(j1=0;j1<m;j1++){
-      			 for(j=0;j<blocksize;j++){
-      			 fcoding[i][j+j1*blocksize]=*(tempcoding[j1]+i*blocksize+j);}}}
 
 timing_set(&t11);
-char **data11;
-char **data12;
-
-
-
-char **data111;		
-data111 = (char **)malloc(sizeof(char *)*k);
-for(i=0;i<k;i++){
-data111[i] = (char *)malloc(sizeof(char)*blocksize);}
-
-char **coding111;
-coding111 = (char **)malloc(sizeof(char *)*4);
-for(i=0;i<2;i++){
-coding111[i] = (char *)malloc(sizeof(char)*blocksize);}
-
-   			char  **Eextra;
-			Eextra = (char **)malloc(sizeof(char*)*64);
-			for(j = 0; j < 64; j++) {
-			Eextra[j] = (char *)malloc(sizeof(char)*blocksize);} 
-			char  **Eextra1;
-			Eextra1 = (char **)malloc(sizeof(char*)*64);
-			for(j = 0; j < 64; j++) {
-			Eextra1[j] = (char *)malloc(sizeof(char)*blocksize);} 
-			
-			//save the original value
-			for(j=0;j<64;j++) {
-			for(i1=0;i1<blocksize;i1++){
-			Eextra[j][i1]=*(fdata[2*j]+1*blocksize+i1);}}//node1 original value not loaded  0 2 4 6                    
-		
-			for(j=0;j<64;j++) {
-			for(i1=0;i1<blocksize;i1++){
-			Eextra1[j][i1]=Eextra[j][i1];}}//node1 original value not loaded
 
+		layer_decoder = NULL;
+		if (decoder_cache != NULL) {
+			layer_decoder = clay_decoder_cache_get(decoder_cache, erased);
+			if (layer_decoder == NULL) {
+				fprintf(stderr, "Unsuccessful!\n");
+				exit(0);
+			}
+		}
 timing_set(&t21);
-	
-                       
 printf( " input data complete\n");
 printf( " bit_operation_start: \n");
-
-
-
 timing_set(&q1);
-
-printf( " \n");	
-
-//char **extra;
-extra = (char **)malloc(sizeof(char*)*64);
-for(i = 0; i < 64; i++) {
-extra[i] = (char *)malloc(sizeof(char)*blocksize);}
-
-
-//char **factor;
-factor = (char **)malloc(sizeof(char*)*64);
-for(i = 0; i < 64; i++) {
-factor[i] = (char *)malloc(sizeof(char)*blocksize);}
-printf( " \n");
-
-
-//char *cons;
-cons = (char *)malloc(sizeof(char)*3);
-cons[0]=1;cons[1]=r;
-
-galois_region_xor1(&cons[0],&cons[1],(cons+2),1);
-//cons[2]=3;
-printf("cons[2]: %d ",*(cons+2));
-
-////////////////////	
-
-/*for(i=0;i<M;i++){//i=0 2 4 6 8 10 12 14 16..............
-
-	
-if( i%2 == 0){
-//save original value
-for(i1 = 0; i1< blocksize; i1++){
-extra[i/2][i1]=*(fdata[i+1] + i1);}
-
-//oringinal two element XOR---save in first row
-			
-
-galois_w8_region_xor(fdata[i+1],(fdata[i] + blocksize),blocksize);
-			
-
-//for(i1=0;i1<blocksize;i1++){
-//factor[i/2][i1]=divide((*(fdata[i] + blocksize+i1)),cons[2]);}
-
-
-
-
-
-galois_w08_region_multiply((fdata[i] + blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[i/2], 0);
-
-
-
-
-
-			
-//get the factor
-
-galois_w8_region_xor(factor[i/2],fdata[i+1],blocksize);
-			
-//second row \times inverse element ---get value first row  save in first row
-
-
-
-//for(i1=0;i1<blocksize;i1++){
-//fdata[i][blocksize+i1]=divide((*(fdata[i+1]+i1)),cons[2]);}//a 0,1
-
-
-galois_w08_region_multiply(fdata[i+1], galois_single_divide(1,cons[2],w), blocksize,(fdata[i] + blocksize), 0);
-
-
-			
-				
-//value \times parameter r   ----save in second row
-
-//for(i1=0;i1<blocksize;i1++){
-galois_w08_region_multiply((fdata[i] + blocksize), r, blocksize, (fdata[i+1]), 0);//}
-
-
-//second row  XOR original value  --get value second row 
-
-galois_w8_region_xor(extra[i/2],fdata[i+1],blocksize);//a 1,0  
-}}*/
-
-
-
-
-
-		
-/////////////////
-
-
-for(i=0;i<M;i++){	
-if( i%4 == 0){//i= 0 4 8 
-
-
-for(i1 = 0; i1< blocksize; i1++) {
-extra[0][i1]=*(fdata[i+2] +2*blocksize+ i1);}
-
-
-galois_w8_region_xor((fdata[i+2]+2*blocksize),(fdata[i] + 3*blocksize),blocksize);
-
-
-galois_w08_region_multiply((fdata[i] + 3*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[0], 0);
-
-
-
-galois_w8_region_xor(factor[0],(fdata[i+2]+2*blocksize),blocksize);
-
-
-
-galois_w08_region_multiply((fdata[i+2]+2*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i] + 3*blocksize), 0);
-
-
-galois_w08_region_multiply((fdata[i] + 3*blocksize), r, blocksize, (fdata[i+2]+2*blocksize), 0);
-
-
-
-galois_w8_region_xor(extra[0],(fdata[i+2]+2*blocksize),blocksize);//a 1,0  
-}}
-
-		
-
-//////////////////////
-//printf( " 3--\n");
-for(i=0;i<M;i++){	
-if( i%8 == 0){
-
-for(j1=0;j1<4;j1++){
-if(j1%2==0){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+4+j1] +4*blocksize+ i1);}
-}}
-
-
-
-
-for(j1=0;j1<4;j1++){
-if(j1%2==0){
-galois_w8_region_xor((fdata[i+4+j1]+4*blocksize),(fdata[i+j1] + 5*blocksize),blocksize);
-}}
-
-
-for(j1=0;j1<4;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1] + 5*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);
-}}
-
-for(j1=0;j1<4;j1++){
-if(j1%2==0){
-galois_w8_region_xor(factor[j1],(fdata[i+j1+4]+4*blocksize),blocksize);
-}}
-
-
-
-for(j1=0;j1<4;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1+4]+4*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i+j1] + 5*blocksize), 0);
-}}
-
-
-for(j1=0;j1<4;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1] + 5*blocksize), r, blocksize, (fdata[i+4+j1]+4*blocksize), 0);
-}}//}
-
-
-
-for(j1=0;j1<4;j1++){
-if(j1%2==0){
-galois_w8_region_xor(extra[j1],(fdata[i+4+j1]+4*blocksize),blocksize);
-}}//a 1,0  
-}}
-/////////////////
-
-for(i=0;i<M;i++){	
-if( i%16 == 0){
-
-for(j1=0;j1<8;j1++){
-if(j1%2==0){//j1=0 2 4 6
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+8+j1] +6*blocksize+ i1);}}}
-
-
-
-
-for(j1=0;j1<8;j1++){
-if(j1%2==0){
-galois_w8_region_xor((fdata[i+8+j1]+6*blocksize),(fdata[i+j1] + 7*blocksize),blocksize);}}
-
-
-for(j1=0;j1<8;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1] + 7*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}}
-
-for(j1=0;j1<8;j1++){
-if(j1%2==0){
-galois_w8_region_xor(factor[j1],(fdata[i+j1+8]+6*blocksize),blocksize);}}
-
-
-
-for(j1=0;j1<8;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1+8]+6*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i+j1] + 7*blocksize), 0);}}
-
-
-for(j1=0;j1<8;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1] + 7*blocksize), r, blocksize, (fdata[i+8+j1]+6*blocksize), 0);}}//}
-
-
-
-for(j1=0;j1<8;j1++){
-if(j1%2==0){
-galois_w8_region_xor(extra[j1],(fdata[i+8+j1]+6*blocksize),blocksize);}}//a 1,0  
-}}
-//////////////////////////////////////////////
-//printf( " 5--\n");
-for(i=0;i<M;i++){	
-if( i%32 == 0){
-
-for(j1=0;j1<16;j1++){
-if(j1%2==0){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+16+j1] +8*blocksize+ i1);}}}
-
-
-for(j1=0;j1<16;j1++){
-if(j1%2==0){
-galois_w8_region_xor((fdata[i+16+j1]+8*blocksize),(fdata[i+j1] + 9*blocksize),blocksize);}}
-
-
-for(j1=0;j1<16;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1] + 9*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}}
-
-for(j1=0;j1<16;j1++){
-if(j1%2==0){
-galois_w8_region_xor(factor[j1],(fdata[i+j1+16]+8*blocksize),blocksize);}}
-
-
-
-for(j1=0;j1<16;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1+16]+8*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fdata[i+j1] + 9*blocksize), 0);}}
-
-
-for(j1=0;j1<16;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fdata[i+j1] + 9*blocksize), r, blocksize, (fdata[i+16+j1]+8*blocksize), 0);}}//}
-
-
-
-for(j1=0;j1<16;j1++){
-if(j1%2==0){
-galois_w8_region_xor(extra[j1],(fdata[i+16+j1]+8*blocksize),blocksize);}}//a 1,0  
-}}
-
-/////////////////////////////////////////
-//printf( " 6--\n");
-for(i=0;i<M;i++){	
-if( i%64 == 0){
-
-for(j1=0;j1<32;j1++){
-if(j1%2==0){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fcoding[i+32+j1] + i1);}}}
-
-for(j1=0;j1<32;j1++){
-if(j1%2==0){
-galois_w8_region_xor(fcoding[i+32+j1],(fcoding[i+j1] + blocksize),blocksize);}}
-
-for(j1=0;j1<32;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fcoding[i+j1] + blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}}
-
-
-for(j1=0;j1<32;j1++){
-if(j1%2==0){
-galois_w8_region_xor(factor[j1],fcoding[i+j1+32],blocksize);}}
-
-for(j1=0;j1<32;j1++){
-if(j1%2==0){
-galois_w08_region_multiply(fcoding[i+j1+32], galois_single_divide(1,cons[2],w), blocksize, (fcoding[i+j1] + blocksize), 0);}}
-
-
-for(j1=0;j1<32;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fcoding[i+j1] + blocksize), r, blocksize, (fcoding[i+32+j1]), 0);}}//}
-
-for(j1=0;j1<32;j1++){
-if(j1%2==0){
-galois_w8_region_xor(extra[j1],fcoding[i+32+j1],blocksize);}}//a 1,0  
-}}
-/////////////////////////////////////////
-//printf( " 7--\n");
-/*for(i=0;i<M;i++){	
-if( i%128 == 0){
-
-for(j1=0;j1<64;j1++){
-if(j1%2==0){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fcoding[i+64+j1]+2*blocksize + i1);}}}
-
-for(j1=0;j1<64;j1++){
-if(j1%2==0){
-galois_w8_region_xor((fcoding[i+64+j1]+2*blocksize),(fcoding[i+j1] + 3*blocksize),blocksize);}}
-
-for(j1=0;j1<64;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fcoding[i+j1] + 3*blocksize), galois_single_divide(1,cons[2],w), blocksize, factor[j1], 0);}}
-
-
-
-for(j1=0;j1<64;j1++){
-if(j1%2==0){
-galois_w8_region_xor(factor[j1],(fcoding[i+j1+64]+2*blocksize),blocksize);}}
-
-for(j1=0;j1<64;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fcoding[i+j1+64]+2*blocksize), galois_single_divide(1,cons[2],w), blocksize, (fcoding[i+j1] + 3*blocksize), 0);}}
-
-
-for(j1=0;j1<64;j1++){
-if(j1%2==0){
-galois_w08_region_multiply((fcoding[i+j1] + 3*blocksize), r, blocksize, (fcoding[i+64+j1]+2*blocksize), 0);}}//}
-
-
-for(j1=0;j1<64;j1++){
-if(j1%2==0){
-galois_w8_region_xor(extra[j1],(fcoding[i+64+j1]+2*blocksize),blocksize);}}//a 1,0  
-}}
-
-
-printf( "bit_operation_ended \n");
-
-for(i=0;i<M;i++){
-for(j=0;j<blocksize;j++){
-fdata[i][blocksize+j]=0;}}
-*/
+		clay_plan_decouple(repair_plan, code, coupler, fdata, fcoding, blocksize);
 timing_set(&q2);
-
 timing_set(&q3);
-
-
-
-
-
-				/*printf("\nfdata RS \n");
-				for(i1=0;i1<5;i1++){
-	                        for(j1=0;j1<k;j1++)
-                                   {
-					printf("%d ",fdata[i1][j1*blocksize]);
-			           }
-				printf( " \n");}
-
-				printf("\nfdata RS \n");
-				for(i1=0;i1<5;i1++){
-	                        for(j1=0;j1<m;j1++)
-                                   {
-					printf("%d ",fcoding[i1][j1*blocksize]);
-			           }
-				printf( " \n");}*/
-
-
-//unsigned char **load1;
-
-
-
-		int **vandemonde;
-		vandemonde = (int **)malloc(sizeof(int*)*4);
-		for (i = 0; i < 4; i++) {
-		vandemonde[i] = (int *)malloc(sizeof(int)*k);}
-
-		int *Gmatrix1_copy;
-		Gmatrix1_copy = (int *)malloc(sizeof(int)*2*k);//yi wei
-		
-     
-
-		int *p;
-		int *p2group;
-		int *p3group;
-
-		p = (int *)malloc(sizeof(int)*k);
-		p2group = (int *)malloc(sizeof(int)*k);
-		p3group = (int *)malloc(sizeof(int)*k);
-
-
-
-
-
-		     // for(i=0;i<10;i++)  {p[i]=(int)i+1;}
-		       
-printf("\n3 \n");
-	        int **p0;
-		
-		p0 = (int **)malloc(sizeof(int*)*k);
-		for(j = 0; j < k; j++) {
- 		p0[j] = (int *)malloc(sizeof(int)*blocksize);}
-printf("\n4 \n");	          
-
-			p[0]=1;p[1]=147;p[2]=138;p[3]=73;p[4]=93;p[5]=161;p[6]=103;p[7]=58;p[8]=99;p[9]=178;
-		        for(i=0;i<10;i++){
-		        galois_w08_region_multiply((p+i), (int)p[i], 1, (p2group+i), 0);}
-			for(i=0;i<10;i++){
-		        galois_w08_region_multiply((p2group+i), (int)p[i], 1, (p3group+i), 0);}
-
-
-
-
-
-		
-			for( j=0;j<k;j++){//true
-		        vandemonde[0][j]=(int)1;
-		        vandemonde[1][j]=(int)p[j];
-		        vandemonde[2][j]=(int)p2group[j];
-		        vandemonde[3][j]=(int)p3group[j];
-		        }
-			
-			for(i=0;i<2;i++){
-			for(i1=0;i1<10;i1++){
-			Gmatrix1_copy[i*10+i1]=vandemonde[i][i1];}}
-			
-
-
-//unsigned char **load;
-
- 			
-
-
-
-erasures[1]=1;
-erasures[2]=-1;
-
-     					//if(erased[0]==1 )      
-	        			//{
-
-              
-			/*printf("\n Gmatrix1_copy 10*10: \n ");
-			jerasure_print_matrix(Gmatrix1_copy,2,k,w);*/
-			
-	
-
-printf("\nblocksize complete\n");
-  	
-		
-printf("\n0~\n");
-
- load = (char **)malloc(sizeof(char*)*64);
- for(j = 0; j < 64; j++) {
- load[j] = (char *)malloc(sizeof(char)*k*blocksize);}
-
-
- load1 = (char **)malloc(sizeof(char*)*64);
- for(j = 0; j < 64; j++) {
- load1[j] = (char *)malloc(sizeof(char)*2*blocksize);}
-  					
-					for( i=0;i<64;i++){ //i= 0 1 2 3
-				        for(j1=2;j1<10;j1++){
-					for(i1=0;i1<blocksize;i1++){
-						load[i][j1*blocksize+i1]=(char)*(fdata[2*i]+j1*blocksize+i1);}}}//i =0 2 4 6
-
-
-				        for( i=0;i<64;i++){
-					for(j=0;j<2;j++){   
-				        for(i1=0;i1<blocksize;i1++){
-						load1[i][j*blocksize+i1]=(char)*(fcoding[2*i]+j*blocksize+i1);}}}
-
-printf("\nload data ended\n");
-
-			/*printf("\nload1\n");
-			for(i=0;i<4;i++){
-			for(j=0;j<2;j++){   
-			printf(" %d ",load1[i][j*blocksize]);}
-			printf("\n");}
-					printf("\nfcoding\n");
-					for(i=0;i<4;i++){
-					for(j=0;j<2;j++){   
-					printf(" %d ",*(fcoding[2*i]+j*blocksize));}
-					printf("\n");} 
-
-			printf("\nload\n");
-			for( i=0;i<4;i++){
-			for(j=0;j<10;j++){   
-			printf(" %d ",load[i][j*blocksize]);}
-			printf("\n");}
-					printf("\nfdata\n");
-					for(i=0;i<4;i++){
-					for(j=0;j<k;j++){   
-					printf(" %d ",*(fdata[2*i]+j*blocksize));}
-					printf("\n");} */
-
-
-
-		for(i4=0;i4<64;i4++){
-
-		for(jj=0;jj<2;jj++){		
-		coding111[jj] = (load1[i4]+jj*blocksize);}
-		for(j=0;j<k;j++){
-		data111[j] = (load[i4]+j*blocksize);}
-
-
-	        jerasure_matrix_decode(k, m, w, Gmatrix1_copy, 0, erasures, data111, coding111, blocksize);
-
-	
-		}//i4
-printf( "\n decdoder complete \n");
-data11 = (char **)malloc(sizeof(char*)*64);
-for(j = 0; j < 64; j++) {
-data11[j] = (char *)malloc(sizeof(char)*blocksize);}
-
-data12 = (char **)malloc(sizeof(char*)*64);
-for(j = 0; j < 64; j++) {
-data12[j] = (char *)malloc(sizeof(char)*blocksize);}
-
-
-			/*printf("\n load 8*10: char \n ");
-		        for(i1=0;i1<8;i1++){
-		        for(j=0;j<10;j++){
-			printf(" %d ",load[i1][j*blocksize]);}
-			printf("\n");	}*/
-
-
-
-		for(i4=0;i4<64;i4++){
-
-		for(i1=0;i1<blocksize;i1++){
-		data11[i4][i1]=*(load[i4]+i1);}//node0 solved value
-
-			
-		for(i1=0;i1<blocksize;i1++){
-		data12[i4][i1]=*(load[i4]+blocksize+i1);}//node1 solved value
-			
+		i3 = 0;
+		for (i4 = 0; i4 < alpha/code->q; i4++) {
+			z = clay_code_repair_layer(code, lost, i4);
+			for (j = 0; j < k; j++) {
+				data[j] = (scratch[j] != NULL) ? scratch[j] :
+				          clay_code_subchunk(code, fdata, fcoding, j, z, blocksize);
+			}
+			for (j = 0; j < m; j++) {
+				coding[j] = (scratch[k+j] != NULL) ? scratch[k+j] :
+				            clay_code_subchunk(code, fdata, fcoding, k+j, z, blocksize);
+			}
+			if (layer_decoder != NULL) {
+				i3 = clay_layer_decode(layer_decoder, data, coding, blocksize);
+			}
+			else if (tech == Reed_Sol_Van || tech == Reed_Sol_R6_Op) {
+				i3 = jerasure_matrix_decode(k, m, w, matrix, 0, erasures, data, coding, blocksize);
+			}
+			else if (tech == Cauchy_Orig || tech == Cauchy_Good) {
+				i3 = jerasure_schedule_decode_lazy(k, m, w, bitmatrix, erasures, data, coding, blocksize, packetsize, 1);
+			}
+			if (i3 == -1) {
+				fprintf(stderr, "Unsuccessful!\n");
+				exit(0);
+			}
+			clay_code_repair_finish(code, coupler, lost, z, scratch + code->y[lost]*code->q,
+			                        fdata, fcoding, blocksize);
 		}
-	
-printf("\n6\n");	
- 			   char **original1;
- 			   original1 = (char **)malloc(sizeof(char*)*64);
-			   for(j = 0; j < 64; j++) {
-			   original1[j] = (char *)malloc(sizeof(char)*blocksize);} 
-			  
-				
-			  for(j=0;j<64;j++){	  	
-			   galois_w8_region_xor(data12[j],Eextra[j],blocksize); 
-			   galois_w08_region_multiply(Eextra[j], galois_single_divide(1,r,w), blocksize, Eextra[j], 0);}
-
-			
-
-			for(i=0;i<64;i++){
-			for(j=0;j<blocksize;j++){
-			original1[i][j]=Eextra[i][j];}}
-
-		
-
-			//node 0
-			    for(i=0;i<64;i++){
-			     for(i1=0;i1<blocksize;i1++){				
-			      fdata[2*i+1][0+i1]=*(original1[i]+i1);//i=1 3 5 7
-			      fdata[2*i][0+i1]=*(data11[i]+i1);}}//i = 0 2 4 6
-
-			
-
-
-   			/*printf("\n fdata 8*10: char \n ");
-		        for(i1=0;i1<8;i1++){
-		        for(j=0;j<10;j++){
-			printf(" %d ",fdata[i1][j*blocksize]);}
-			printf("\n");	}*/
-			
-
-
-		//}//if erasure
-		
-
-
-
-
-
-
+		clay_decoder_cache_put(decoder_cache, layer_decoder);
 timing_set(&q4);
-
 printf( "decode complete \n");
-
-
-//printf( " decoded :\n");
-
-		
-		/* Create decoded file */
-		sprintf(fname, "%s/Coding/%s_decoded%s", curdir, cs1, extension);
+		/* Write the repaired node back to its file */
+		node_file(fname, curdir, cs1, md, k, lost, extension);
 		if (n == 1) {
-			fp = fopen(fname, "wb");
+			out_fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (out_fd < 0) {
+				fprintf(stderr, "Unable to create %s.\n", fname);
+				exit(0);
+			}
 		}
-		else {
-			fp = fopen(fname, "ab");
+		out_iov.iov_base = clay_code_subchunk(code, fdata, fcoding, lost, 0, blocksize);
+		out_iov.iov_len = (size_t)alpha*blocksize;
+		if (clay_io_writev(io, out_fd, &out_iov, 1, (off_t)(n-1)*alpha*blocksize, fname) < 0 ||
+		    clay_io_submit(io) < 0) {
+			fprintf(stderr, "Unable to write %s.\n", fname);
+			exit(0);
 		}
-		
-		for (i4 = 0; i4 < M; i4++) {
-		//for (i1 = 0; i1 < k; i1++) {
-			//if (total+blocksize <= origsize) {
-			//  fwrite(data[i1], sizeof(char), blocksize, fp);
-			 // total+= blocksize;}
-
-			if (total+k*blocksize <= origsize) {
-			   //fwrite(ffdata[i4], sizeof(char), k*blocksize, fp);
-				fwrite(fdata[i4], sizeof(char), k*blocksize, fp);
-			   total+= k*blocksize;}
-			   
-			else {
-				//for (j = 0; j < blocksize; j++) {
-				for (i5 = 0; i5 < k*blocksize; i5++) {
-					if (total < origsize) {
-						//fprintf(fp, "%c", ffdata[i4][i5]);
-						fprintf(fp, "%c", fdata[i4][i5]);
-						total++;
-					}
-					else {
-						break;
-					}
-					
-				}
-			}//else
-		}
-
-
-
-
+		wait_io(io, fname, (long)alpha*blocksize);
 printf( "\neraaed:\n");
 
 for(j1=0;j1<k+m;j1++)
@@ -1072,7 +593,6 @@ printf( " end~\n");
 
 
 		n++;
-		fclose(fp);
 		//matrix_time= timing_delta(&q5, &q6);
 		
 		bit_operation_time= timing_delta(&q1, &q2);
@@ -1085,11 +605,35 @@ printf( " end~\n");
 
 
 	}//while
+	for (i = 0; i < k+m; i++) {
+		if (node_fd[i] >= 0) {
+			close(node_fd[i]);
+		}
+		free(node_name[i]);
+		free(scratch[i]);
+	}
+	free(node_name);
+	free(scratch);
+	free(helper);
+	if (out_fd >= 0) {
+		close(out_fd);
+	}
+	clay_io_free(io);
 	
 	/* Free allocated memory */
 	free(cs1);
 	free(extension);
 	free(fname);
+	clay_plan_free(repair_plan);
+	clay_decoder_cache_free(decoder_cache);
+	for (cur = 0; cur < nbufs; cur++) {
+		free(fdata_set[cur]);
+		free(fcoding_set[cur]);
+		free(databuf[cur]);
+		free(codingbuf[cur]);
+	}
+	clay_coupler_free(coupler);
+	clay_code_free(code);
 	//free(data);
 	//free(coding);
 	//free(erasures);